@@ -0,0 +1,491 @@
+#include "event_json.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+enum {
+    STATE_START = 0,
+    STATE_OBJECT_KEY_OR_END,
+    STATE_OBJECT_KEY,
+    STATE_COLON,
+    STATE_VALUE,
+    STATE_ARRAY_VALUE_OR_END,
+    STATE_AFTER_VALUE,
+    STATE_STRING,
+    STATE_ESCAPE,
+    STATE_UNICODE,
+    STATE_NUMBER,
+    STATE_LITERAL,
+    STATE_DONE,
+    STATE_ERROR,
+};
+
+enum {
+    TARGET_NONE = 0,
+    TARGET_TYPE,
+    TARGET_SENDER,
+    TARGET_MESSAGE,
+    TARGET_TIMESTAMP,
+    TARGET_SEQUENCE,
+};
+
+static bool is_whitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void event_json_init(event_json_parser_t* parser, event_json_event_t* out) {
+    memset(parser, 0, sizeof(event_json_parser_t));
+    memset(out, 0, sizeof(event_json_event_t));
+    parser->out   = out;
+    parser->state = STATE_START;
+}
+
+static void append_byte(event_json_parser_t* parser, char c) {
+    if (parser->is_key) {
+        if (parser->key_length < EVENT_JSON_KEY_LENGTH - 1) {
+            parser->key[parser->key_length++] = c;
+            parser->key[parser->key_length]   = '\0';
+        } else {
+            parser->key_overflow = true;
+        }
+        return;
+    }
+    if (parser->string == NULL) {
+        return;
+    }
+    if (parser->string_length < parser->string_capacity - 1) {
+        parser->string[parser->string_length++] = c;
+        parser->string[parser->string_length]   = '\0';
+    } else {
+        parser->out->fields |= EVENT_JSON_FIELD_TRUNCATED;
+        parser->string       = NULL;  // Drop the rest of the value
+    }
+}
+
+static void append_codepoint(event_json_parser_t* parser, uint32_t codepoint) {
+    if (codepoint < 0x80) {
+        append_byte(parser, codepoint);
+    } else if (codepoint < 0x800) {
+        append_byte(parser, 0xC0 | (codepoint >> 6));
+        append_byte(parser, 0x80 | (codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+        append_byte(parser, 0xE0 | (codepoint >> 12));
+        append_byte(parser, 0x80 | ((codepoint >> 6) & 0x3F));
+        append_byte(parser, 0x80 | (codepoint & 0x3F));
+    } else {
+        append_byte(parser, 0xF0 | (codepoint >> 18));
+        append_byte(parser, 0x80 | ((codepoint >> 12) & 0x3F));
+        append_byte(parser, 0x80 | ((codepoint >> 6) & 0x3F));
+        append_byte(parser, 0x80 | (codepoint & 0x3F));
+    }
+}
+
+// A high surrogate that is not followed by a low surrogate becomes a replacement character
+static void flush_surrogate(event_json_parser_t* parser) {
+    if (parser->high_surrogate != 0) {
+        parser->high_surrogate = 0;
+        append_codepoint(parser, 0xFFFD);
+    }
+}
+
+static void end_string_value(event_json_parser_t* parser) {
+    char* value = NULL;
+    switch (parser->target) {
+        case TARGET_TYPE:
+            value                = parser->out->type;
+            parser->out->fields |= EVENT_JSON_FIELD_TYPE;
+            break;
+        case TARGET_SENDER:
+            value                = parser->out->sender;
+            parser->out->fields |= EVENT_JSON_FIELD_SENDER;
+            break;
+        case TARGET_MESSAGE:
+            value                = parser->out->message;
+            parser->out->fields |= EVENT_JSON_FIELD_MESSAGE;
+            break;
+        default:
+            return;
+    }
+
+    if (parser->string == NULL) {
+        // Truncated, do not leave a partial UTF-8 sequence at the end
+        size_t length = strlen(value);
+        size_t end    = length;
+        while (end > 0 && (value[end - 1] & 0xC0) == 0x80) {
+            end--;
+        }
+        if (end > 0 && (value[end - 1] & 0x80)) {
+            unsigned char lead     = value[end - 1];
+            size_t        expected = (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : 4;
+            if (length - (end - 1) < expected) {
+                value[end - 1] = '\0';
+            }
+        }
+    }
+}
+
+static void select_target(event_json_parser_t* parser, bool is_string) {
+    parser->target = TARGET_NONE;
+    if (parser->depth != 1 || parser->key_overflow) {
+        return;
+    }
+    if (is_string && strcmp(parser->key, "type") == 0) {
+        parser->target          = TARGET_TYPE;
+        parser->string          = parser->out->type;
+        parser->string_capacity = EVENT_JSON_TYPE_LENGTH;
+    } else if (is_string && strcmp(parser->key, "sender") == 0) {
+        parser->target          = TARGET_SENDER;
+        parser->string          = parser->out->sender;
+        parser->string_capacity = EVENT_JSON_SENDER_LENGTH;
+    } else if (is_string && strcmp(parser->key, "message") == 0) {
+        parser->target          = TARGET_MESSAGE;
+        parser->string          = parser->out->message;
+        parser->string_capacity = EVENT_JSON_MESSAGE_LENGTH;
+    } else if (!is_string && strcmp(parser->key, "timestamp") == 0) {
+        parser->target = TARGET_TIMESTAMP;
+    } else if (!is_string && strcmp(parser->key, "seq") == 0) {
+        parser->target = TARGET_SEQUENCE;
+    }
+    if (parser->string != NULL) {
+        parser->string_length = 0;
+        parser->string[0]     = '\0';
+    }
+}
+
+static bool push_container(event_json_parser_t* parser, bool object) {
+    if (parser->depth >= EVENT_JSON_MAX_DEPTH) {
+        return false;
+    }
+    if (object) {
+        parser->containers |= (1u << parser->depth);
+    } else {
+        parser->containers &= ~(1u << parser->depth);
+    }
+    parser->depth++;
+    parser->state = object ? STATE_OBJECT_KEY_OR_END : STATE_ARRAY_VALUE_OR_END;
+    return true;
+}
+
+static bool in_object(event_json_parser_t const* parser) {
+    return parser->containers & (1u << (parser->depth - 1));
+}
+
+static void pop_container(event_json_parser_t* parser) {
+    parser->depth--;
+    parser->state = parser->depth == 0 ? STATE_DONE : STATE_AFTER_VALUE;
+}
+
+// Start a value at character c, returns false if no value can start with it
+static bool begin_value(event_json_parser_t* parser, char c) {
+    parser->string = NULL;
+    switch (c) {
+        case '"':
+            select_target(parser, true);
+            parser->is_key       = false;
+            parser->return_state = STATE_AFTER_VALUE;
+            parser->state        = STATE_STRING;
+            return true;
+        case '{':
+            return push_container(parser, true);
+        case '[':
+            return push_container(parser, false);
+        case 't':
+            parser->literal = "true";
+            break;
+        case 'f':
+            parser->literal = "false";
+            break;
+        case 'n':
+            parser->literal = "null";
+            break;
+        default:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                select_target(parser, false);
+                parser->negative     = c == '-';
+                parser->integer_part = true;
+                parser->has_digits   = c != '-';
+                parser->number       = c == '-' ? 0 : c - '0';
+                parser->state        = STATE_NUMBER;
+                return true;
+            }
+            return false;
+    }
+    parser->literal_index = 1;
+    parser->state         = STATE_LITERAL;
+    return true;
+}
+
+static void end_number(event_json_parser_t* parser) {
+    if (parser->target == TARGET_TIMESTAMP) {
+        parser->out->timestamp  = parser->negative ? -parser->number : parser->number;
+        parser->out->fields    |= EVENT_JSON_FIELD_TIMESTAMP;
+    } else if (parser->target == TARGET_SEQUENCE && !parser->negative && parser->number <= UINT32_MAX) {
+        parser->out->sequence  = parser->number;
+        parser->out->fields   |= EVENT_JSON_FIELD_SEQUENCE;
+    }
+    parser->state = STATE_AFTER_VALUE;
+}
+
+event_json_result_t event_json_feed(event_json_parser_t* parser, char const* data, size_t length) {
+    size_t i = 0;
+    while (i < length && parser->state != STATE_ERROR) {
+        char c        = data[i];
+        bool consumed = true;
+
+        switch (parser->state) {
+            case STATE_START:
+                if (c == '{') {
+                    push_container(parser, true);
+                } else if (!is_whitespace(c)) {
+                    parser->state = STATE_ERROR;
+                }
+                break;
+
+            case STATE_OBJECT_KEY_OR_END:
+                if (c == '}') {
+                    pop_container(parser);
+                    break;
+                }
+                // Fall through
+            case STATE_OBJECT_KEY:
+                if (c == '"') {
+                    parser->is_key       = true;
+                    parser->key_length   = 0;
+                    parser->key[0]       = '\0';
+                    parser->key_overflow = false;
+                    parser->return_state = STATE_COLON;
+                    parser->state        = STATE_STRING;
+                } else if (!is_whitespace(c)) {
+                    parser->state = STATE_ERROR;
+                }
+                break;
+
+            case STATE_COLON:
+                if (c == ':') {
+                    parser->state = STATE_VALUE;
+                } else if (!is_whitespace(c)) {
+                    parser->state = STATE_ERROR;
+                }
+                break;
+
+            case STATE_ARRAY_VALUE_OR_END:
+                if (c == ']') {
+                    pop_container(parser);
+                    break;
+                }
+                // Fall through
+            case STATE_VALUE:
+                if (!is_whitespace(c) && !begin_value(parser, c)) {
+                    parser->state = STATE_ERROR;
+                }
+                break;
+
+            case STATE_AFTER_VALUE:
+                if (c == ',') {
+                    parser->state = in_object(parser) ? STATE_OBJECT_KEY : STATE_VALUE;
+                } else if ((c == '}' && in_object(parser)) || (c == ']' && !in_object(parser))) {
+                    pop_container(parser);
+                } else if (!is_whitespace(c)) {
+                    parser->state = STATE_ERROR;
+                }
+                break;
+
+            case STATE_STRING:
+                if (c == '"') {
+                    flush_surrogate(parser);
+                    if (!parser->is_key) {
+                        end_string_value(parser);
+                    }
+                    parser->state = parser->return_state;
+                } else if (c == '\\') {
+                    parser->state = STATE_ESCAPE;
+                } else if ((unsigned char)c < 0x20) {
+                    parser->state = STATE_ERROR;
+                } else {
+                    flush_surrogate(parser);
+                    append_byte(parser, c);
+                }
+                break;
+
+            case STATE_ESCAPE: {
+                char decoded = 0;
+                switch (c) {
+                    case '"':
+                    case '\\':
+                    case '/':
+                        decoded = c;
+                        break;
+                    case 'b':
+                        decoded = '\b';
+                        break;
+                    case 'f':
+                        decoded = '\f';
+                        break;
+                    case 'n':
+                        decoded = '\n';
+                        break;
+                    case 'r':
+                        decoded = '\r';
+                        break;
+                    case 't':
+                        decoded = '\t';
+                        break;
+                    case 'u':
+                        parser->codepoint  = 0;
+                        parser->hex_digits = 0;
+                        parser->state      = STATE_UNICODE;
+                        break;
+                    default:
+                        parser->state = STATE_ERROR;
+                        break;
+                }
+                if (decoded != 0) {
+                    flush_surrogate(parser);
+                    append_byte(parser, decoded);
+                    parser->state = STATE_STRING;
+                }
+                break;
+            }
+
+            case STATE_UNICODE: {
+                int value = hex_value(c);
+                if (value < 0) {
+                    parser->state = STATE_ERROR;
+                    break;
+                }
+                parser->codepoint = (parser->codepoint << 4) | value;
+                if (++parser->hex_digits < 4) {
+                    break;
+                }
+                uint32_t codepoint = parser->codepoint;
+                if (codepoint >= 0xDC00 && codepoint <= 0xDFFF && parser->high_surrogate != 0) {
+                    codepoint              = 0x10000 + ((parser->high_surrogate - 0xD800) << 10) + (codepoint - 0xDC00);
+                    parser->high_surrogate = 0;
+                    append_codepoint(parser, codepoint);
+                } else if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+                    flush_surrogate(parser);
+                    parser->high_surrogate = codepoint;
+                } else {
+                    flush_surrogate(parser);
+                    append_codepoint(parser, (codepoint >= 0xDC00 && codepoint <= 0xDFFF) ? 0xFFFD : codepoint);
+                }
+                parser->state = STATE_STRING;
+                break;
+            }
+
+            case STATE_NUMBER:
+                if (c >= '0' && c <= '9') {
+                    parser->has_digits = true;
+                    if (parser->integer_part) {
+                        // Saturate instead of overflowing
+                        if (parser->number > (INT64_MAX - (c - '0')) / 10) {
+                            parser->number = INT64_MAX;
+                        } else {
+                            parser->number = parser->number * 10 + (c - '0');
+                        }
+                    }
+                } else if (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+                    // Only the integer part is kept
+                    parser->integer_part = false;
+                } else if (!parser->has_digits) {
+                    parser->state = STATE_ERROR;
+                } else {
+                    end_number(parser);
+                    consumed = false;
+                }
+                break;
+
+            case STATE_LITERAL:
+                if (c != parser->literal[parser->literal_index]) {
+                    parser->state = STATE_ERROR;
+                } else if (parser->literal[++parser->literal_index] == '\0') {
+                    parser->state = STATE_AFTER_VALUE;
+                }
+                break;
+
+            case STATE_DONE:
+                if (!is_whitespace(c)) {
+                    parser->state = STATE_ERROR;
+                }
+                break;
+
+            default:
+                parser->state = STATE_ERROR;
+                break;
+        }
+
+        if (consumed) {
+            i++;
+        }
+    }
+
+    parser->offset += i;
+    if (parser->state == STATE_ERROR) {
+        return EVENT_JSON_ERROR;
+    }
+    return parser->state == STATE_DONE ? EVENT_JSON_DONE : EVENT_JSON_INCOMPLETE;
+}
+
+// Call once the whole payload has been fed, anything but a closed top level object is an error
+event_json_result_t event_json_finish(event_json_parser_t* parser) {
+    if (parser->state != STATE_DONE) {
+        parser->state = STATE_ERROR;
+        return EVENT_JSON_ERROR;
+    }
+    return EVENT_JSON_DONE;
+}
+
+// Append to out like snprintf, keeping track of the length the full output would have
+static void append(char* out, size_t size, size_t* length, char const* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(*length < size ? out + *length : NULL, *length < size ? size - *length : 0, format, args);
+    va_end(args);
+    *length += written > 0 ? written : 0;
+}
+
+static void append_string(char* out, size_t size, size_t* length, char const* key, char const* value) {
+    append(out, size, length, "%s\"%s\":\"", *length > 1 ? "," : "", key);
+    for (unsigned char const* c = (unsigned char const*)value; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            append(out, size, length, "\\%c", *c);
+        } else if (*c < 0x20) {
+            append(out, size, length, "\\u%04x", *c);
+        } else {
+            append(out, size, length, "%c", *c);
+        }
+    }
+    append(out, size, length, "\"");
+}
+
+// Serialize the fields present in an event. Returns the length of the full output like snprintf,
+// the output is only complete when that is below size.
+size_t event_json_format(char* out, size_t size, event_json_event_t const* event) {
+    size_t length = 0;
+    append(out, size, &length, "{");
+    if (event->fields & EVENT_JSON_FIELD_TYPE) {
+        append_string(out, size, &length, "type", event->type);
+    }
+    if (event->fields & EVENT_JSON_FIELD_SENDER) {
+        append_string(out, size, &length, "sender", event->sender);
+    }
+    if (event->fields & EVENT_JSON_FIELD_SEQUENCE) {
+        append(out, size, &length, "%s\"seq\":%" PRIu32, length > 1 ? "," : "", event->sequence);
+    }
+    if (event->fields & EVENT_JSON_FIELD_MESSAGE) {
+        append_string(out, size, &length, "message", event->message);
+    }
+    if (event->fields & EVENT_JSON_FIELD_TIMESTAMP) {
+        append(out, size, &length, "%s\"timestamp\":%" PRId64, length > 1 ? "," : "", event->timestamp);
+    }
+    append(out, size, &length, "}");
+    return length;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental parser for event notifications of the form
+//   {"type": "coffee", "sender": "badge-1234", "seq": 42, "message": "Fresh pot!", "timestamp": 1735689600000}
+// Input may be fed in arbitrary chunks, as delivered by MQTT_EVENT_DATA fragments. The parser never
+// allocates: all state lives in event_json_parser_t. Unknown keys and nested values are skipped,
+// strings longer than their destination are truncated. The timestamp is the send time, in seconds or
+// milliseconds since the epoch.
+
+#define EVENT_JSON_TYPE_LENGTH    16
+#define EVENT_JSON_SENDER_LENGTH  32
+#define EVENT_JSON_MESSAGE_LENGTH 128
+#define EVENT_JSON_KEY_LENGTH     16
+#define EVENT_JSON_MAX_DEPTH      32
+
+typedef enum {
+    EVENT_JSON_FIELD_TYPE      = (1 << 0),
+    EVENT_JSON_FIELD_SENDER    = (1 << 1),
+    EVENT_JSON_FIELD_MESSAGE   = (1 << 2),
+    EVENT_JSON_FIELD_TIMESTAMP = (1 << 3),
+    EVENT_JSON_FIELD_SEQUENCE  = (1 << 4),
+    EVENT_JSON_FIELD_TRUNCATED = (1 << 7),  // At least one string did not fit
+} event_json_field_t;
+
+typedef struct {
+    char     type[EVENT_JSON_TYPE_LENGTH];
+    char     sender[EVENT_JSON_SENDER_LENGTH];
+    char     message[EVENT_JSON_MESSAGE_LENGTH];
+    int64_t  timestamp;
+    uint32_t sequence;
+    uint32_t fields;  // Bitmask of event_json_field_t
+} event_json_event_t;
+
+typedef enum {
+    EVENT_JSON_INCOMPLETE = 0,  // Valid so far, more input expected
+    EVENT_JSON_DONE,            // The top level object has been closed
+    EVENT_JSON_ERROR,           // Malformed input, the parser stays in this state until reset
+} event_json_result_t;
+
+typedef struct {
+    event_json_event_t* out;
+    uint8_t             state;
+    uint8_t             return_state;  // State to continue in after a string, number or literal
+    uint8_t             depth;
+    uint32_t            containers;  // Bit per nesting level, set for objects and clear for arrays
+    uint8_t             target;      // Field the current value is stored into, 0 when skipped
+    bool                is_key;
+    char                key[EVENT_JSON_KEY_LENGTH];
+    uint8_t             key_length;
+    bool                key_overflow;
+    char*               string;  // Destination of the current string value
+    size_t              string_capacity;
+    size_t              string_length;
+    uint32_t            codepoint;
+    uint8_t             hex_digits;
+    uint32_t            high_surrogate;
+    char const*         literal;
+    uint8_t             literal_index;
+    bool                negative;
+    bool                integer_part;
+    bool                has_digits;
+    int64_t             number;
+    size_t              offset;  // Bytes consumed, for error reporting
+} event_json_parser_t;
+
+void                event_json_init(event_json_parser_t* parser, event_json_event_t* out);
+event_json_result_t event_json_feed(event_json_parser_t* parser, char const* data, size_t length);
+event_json_result_t event_json_finish(event_json_parser_t* parser);
+size_t              event_json_format(char* out, size_t size, event_json_event_t const* event);
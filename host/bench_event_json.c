@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "event_json.h"
+
+// Measures event_json throughput when a payload arrives whole and when it arrives in small
+// fragments, the way esp-mqtt delivers messages larger than its receive buffer
+
+static char const payload[] =
+    "{\"type\": \"coffee\", \"sender\": \"badge-4f2a\", \"timestamp\": 1735689600, "
+    "\"message\": \"Fresh pot on the 3rd floor \\u2615, come and get it!\", "
+    "\"extra\": {\"floor\": 3, \"tags\": [\"kitchen\", \"hot\", null, true, 1.5e3]}}";
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char** argv) {
+    int    iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    size_t length     = strlen(payload);
+    size_t chunks[]   = {length, 256, 64, 16, 1};
+
+    event_json_parser_t parser;
+    event_json_event_t  event;
+
+    printf("payload: %zu bytes, parser state: %zu bytes\n\n", length, sizeof(event_json_parser_t));
+    printf("%-8s %12s %12s\n", "chunk", "ns/message", "MB/s");
+
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        size_t chunk  = chunks[c];
+        double start  = now_us();
+        int    failed = 0;
+        for (int n = 0; n < iterations; n++) {
+            event_json_init(&parser, &event);
+            for (size_t offset = 0; offset < length; offset += chunk) {
+                size_t size = length - offset < chunk ? length - offset : chunk;
+                event_json_feed(&parser, payload + offset, size);
+            }
+            if (event_json_finish(&parser) != EVENT_JSON_DONE) {
+                failed++;
+            }
+        }
+        double elapsed = now_us() - start;
+        printf("%-8zu %12.1f %12.1f%s\n", chunk, elapsed * 1000.0 / iterations, length * iterations / elapsed,
+               failed ? "  (parse errors!)" : "");
+    }
+
+    printf("\ntype=\"%s\" sender=\"%s\" timestamp=%lld message=\"%s\" fields=0x%02x\n", event.type, event.sender,
+           (long long)event.timestamp, event.message, (unsigned)event.fields);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "gif_decoder.h"
+
+// Decodes a GIF file the way the player does, into a canvas in the rotated layout of the panel,
+// and reports the decode time per frame against the frame delays of the clip
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s file.gif [loops]\n", argv[0]);
+        return 1;
+    }
+    int   loops = argc > 2 ? atoi(argv[2]) : 10;
+    FILE* file  = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    setvbuf(file, NULL, _IOFBF, 16384);
+
+    static gif_t gif;
+    if (!gif_open(&gif, file)) {
+        fprintf(stderr, "%s: not a GIF\n", argv[1]);
+        return 1;
+    }
+
+    // Rotated clockwise like the Tanmatsu panel: oriented x runs down the raw rows
+    uint16_t*    canvas = calloc((size_t)gif.width * gif.height, sizeof(uint16_t));
+    gif_target_t target = {
+        .pixels = canvas,
+        .origin = gif.height - 1,
+        .x_step = gif.height,
+        .y_step = -1,
+        .clip_w = gif.width,
+        .clip_h = gif.height,
+    };
+    gif_set_target(&gif, &target);
+
+    uint32_t     frames = 0, delays = 0, delay_ms;
+    gif_result_t result = GIF_FRAME;
+    double       start  = now_us();
+    for (int loop = 0; loop < loops && result != GIF_ERROR; loop++) {
+        while ((result = gif_next_frame(&gif, &delay_ms)) == GIF_FRAME) {
+            frames++;
+            delays += delay_ms;
+        }
+        gif_rewind(&gif);
+    }
+    double elapsed = now_us() - start;
+
+    printf("%ux%u, %u frames in %d loops%s\n", gif.width, gif.height, frames, loops,
+           result == GIF_ERROR ? " (decode error!)" : "");
+    if (frames > 0) {
+        printf("decode: %.2f ms/frame, clip: %.2f ms/frame\n", elapsed / 1000.0 / frames, (double)delays / frames);
+    }
+    gif_close(&gif);
+    free(canvas);
+    fclose(file);
+    return result == GIF_ERROR;
+}
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "glyph_cache.h"
+#include "pax_fonts.h"
+#include "pax_gfx.h"
+
+// Compares drawing text through the glyph cache against plain pax_draw_text, on a framebuffer with
+// the same raw layout and orientation as the Tanmatsu panel
+
+#define H_RES       480
+#define V_RES       800
+#define ORIENTATION PAX_O_ROT_CW
+
+typedef struct {
+    char const*    name;
+    glyph_cache_t* cache;
+    pax_col_t      color;
+    float          x;
+    float          y;
+    char const*    text;
+} bench_case_t;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 500;
+
+    pax_buf_t fb = {0};
+    pax_buf_init(&fb, NULL, H_RES, V_RES, PAX_BUF_16_565RGB);
+    pax_buf_set_orientation(&fb, ORIENTATION);
+    pax_background(&fb, 0xFF202020);
+
+    glyph_cache_t clock_glyphs = {0}, text_glyphs_18 = {0}, text_glyphs_16 = {0};
+    glyph_cache_set_target(H_RES, V_RES, PAX_BUF_16_565RGB, ORIENTATION, false);
+
+    double start = now_us();
+    glyph_cache_create(&clock_glyphs, pax_font_sky_mono, 100, "0123456789:");
+    glyph_cache_create(&text_glyphs_18, pax_font_sky_mono, 18, GLYPH_CACHE_ASCII_PRINTABLE);
+    glyph_cache_create(&text_glyphs_16, pax_font_sky_mono, 16, GLYPH_CACHE_ASCII_PRINTABLE);
+    printf("Atlas build: %.1f us\n\n", now_us() - start);
+
+    bench_case_t cases[] = {
+        {"clock 100px", &clock_glyphs, 0xFFFFFFFF, 100, 140, "12:34:56"},
+        {"header 18px", &text_glyphs_18, 0xFF2B2C3A, 5, 5, "Event Notifier"},
+        {"button 16px", &text_glyphs_16, 0xFF000000, 100, 100, "Coffee"},
+        {"footer 16px", &text_glyphs_16, 0xFFFFFFFF, 5, 420, "Use left/right to navigate. Press return to select."},
+    };
+
+    printf("%-12s %14s %14s %8s\n", "case", "pax_draw_text", "glyph_cache", "speedup");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        bench_case_t* test = &cases[i];
+
+        start = now_us();
+        for (int n = 0; n < iterations; n++) {
+            pax_draw_text(&fb, test->color, test->cache->font, test->cache->size, test->x, test->y, test->text);
+        }
+        double pax_us = (now_us() - start) / iterations;
+
+        start = now_us();
+        for (int n = 0; n < iterations; n++) {
+            glyph_cache_draw(&fb, test->cache, test->color, test->x, test->y, test->text);
+        }
+        double cache_us = (now_us() - start) / iterations;
+
+        printf("%-12s %11.2f us %11.2f us %7.1fx\n", test->name, pax_us, cache_us, pax_us / cache_us);
+    }
+
+    glyph_cache_destroy(&clock_glyphs);
+    glyph_cache_destroy(&text_glyphs_18);
+    glyph_cache_destroy(&text_glyphs_16);
+    pax_buf_destroy(&fb);
+    return 0;
+}
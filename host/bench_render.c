@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "damage.h"
+#include "esp_timer.h"
+#include "message_rx.h"
+#include "panel.h"
+#include "panel_mock.h"
+#include "topic_router.h"
+#include "ui.h"
+
+// Measures the cost of the frames the application draws, using the real UI code on top of the
+// host panel. Every case applies one change the way the input or MQTT task would, then renders
+// the resulting frame. Pass a file prefix as the second argument to dump every frame as PPM.
+
+#define H_RES       480
+#define V_RES       800
+#define ORIENTATION PAX_O_ROT_CW
+
+typedef struct {
+    char const* name;
+    void (*change)(int iteration);
+    ui_screen_t screen;
+} bench_case_t;
+
+static void change_all(int iteration) {
+    damage_add_all();
+}
+
+static void change_button(int iteration) {
+    ui_select_next_button(true);
+}
+
+static void change_message(int iteration) {
+    char payload[128];
+    int  length = snprintf(payload, sizeof(payload),
+                           "{\"type\":\"coffee\",\"sender\":\"bench\",\"message\":\"Pot %d is ready\",\"timestamp\":%d}",
+                           iteration, 1700000000 + iteration);
+    message_rx_begin("/esp32/coffee", strlen("/esp32/coffee"), TOPIC_HANDLER_ALL);
+    message_rx_feed(payload, length);
+    message_rx_end();
+}
+
+static void change_scroll(int iteration) {
+    ui_scroll_history(iteration % 2 == 0);
+}
+
+static void change_clock(int iteration) {
+    ui_invalidate_clock();
+}
+
+static uint8_t* load_file(char const* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long     length = ftell(file);
+    uint8_t* data   = length > 0 ? malloc(length) : NULL;
+    fseek(file, 0, SEEK_SET);
+    if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = length;
+    return data;
+}
+
+int main(int argc, char** argv) {
+    int         iterations = argc > 1 ? atoi(argv[1]) : 200;
+    char const* dump       = argc > 2 ? argv[2] : NULL;
+
+    if (panel_init(NULL, H_RES, V_RES, PAX_BUF_16_565RGB, ORIENTATION, false) != ESP_OK) {
+        fprintf(stderr, "Failed to initialize the panel\n");
+        return 1;
+    }
+
+    int64_t start = esp_timer_get_time();
+    ui_init(H_RES, V_RES, PAX_BUF_16_565RGB, ORIENTATION, false);
+    printf("UI init: %lld us\n", (long long)(esp_timer_get_time() - start));
+
+    size_t   wallpaper_size = 0;
+    uint8_t* wallpaper      = load_file(NOTIFIER_WALLPAPER, &wallpaper_size);
+    if (wallpaper == NULL) {
+        fprintf(stderr, "Could not read %s, using a plain background\n", NOTIFIER_WALLPAPER);
+    }
+    ui_set_wallpaper(wallpaper, wallpaper_size);
+
+    // Fill the history so scrolling has something to move through
+    for (int i = 0; i < 16; i++) {
+        change_message(i);
+    }
+
+    // The first clock frame decodes the wallpaper into the background layer
+    start = esp_timer_get_time();
+    ui_set_screen(UI_SCREEN_CLOCK);
+    ui_render();
+    printf("Background layer: %lld us\n\n", (long long)(esp_timer_get_time() - start));
+
+    bench_case_t cases[] = {
+        {"gui full", change_all, UI_SCREEN_MAIN},        {"gui button", change_button, UI_SCREEN_MAIN},
+        {"gui message", change_message, UI_SCREEN_MAIN}, {"gui scroll", change_scroll, UI_SCREEN_MAIN},
+        {"clock full", change_all, UI_SCREEN_CLOCK},     {"clock tick", change_clock, UI_SCREEN_CLOCK},
+    };
+
+    panel_mock_set_dump(dump);
+    printf("%-12s %12s %12s %10s %11s\n", "case", "us/frame", "px/frame", "transfers", "% of full");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        bench_case_t* test = &cases[i];
+
+        // Start every case on its screen, with nothing left to draw
+        ui_set_screen(test->screen);
+        ui_render();
+
+        panel_mock_stats_t before = panel_mock_get_stats();
+        start                     = esp_timer_get_time();
+        for (int n = 0; n < iterations; n++) {
+            test->change(n);
+            ui_render();
+        }
+        double             us    = (double)(esp_timer_get_time() - start) / iterations;
+        panel_mock_stats_t after = panel_mock_get_stats();
+
+        double pixels    = (double)(after.pixels - before.pixels) / iterations;
+        double transfers = (double)(after.transfers - before.transfers) / iterations;
+        printf("%-12s %12.1f %12.0f %10.1f %10.1f%%\n", test->name, us, pixels, transfers,
+               100.0 * pixels / (H_RES * V_RES));
+    }
+
+    free(wallpaper);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event_json.h"
+
+// libFuzzer entry point. The first input byte selects the fragment size; the rest is fed both in one
+// piece and in fragments, and both runs have to agree on the result and the extracted event.
+
+static void check_terminated(char const* value, size_t size) {
+    if (memchr(value, '\0', size) == NULL) {
+        abort();
+    }
+}
+
+int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+    size_t      chunk   = data[0] % 16 + 1;
+    char const* payload = (char const*)data + 1;
+    size_t      length  = size - 1;
+
+    event_json_parser_t whole_parser, split_parser;
+    event_json_event_t  whole, split;
+
+    event_json_init(&whole_parser, &whole);
+    event_json_feed(&whole_parser, payload, length);
+    event_json_result_t whole_result = event_json_finish(&whole_parser);
+
+    event_json_init(&split_parser, &split);
+    for (size_t offset = 0; offset < length; offset += chunk) {
+        event_json_feed(&split_parser, payload + offset, length - offset < chunk ? length - offset : chunk);
+    }
+    event_json_result_t split_result = event_json_finish(&split_parser);
+
+    check_terminated(whole.type, sizeof(whole.type));
+    check_terminated(whole.sender, sizeof(whole.sender));
+    check_terminated(whole.message, sizeof(whole.message));
+
+    if (whole_result != split_result) {
+        abort();
+    }
+    if (whole_result == EVENT_JSON_DONE && memcmp(&whole, &split, sizeof(event_json_event_t)) != 0) {
+        abort();
+    }
+    return 0;
+}
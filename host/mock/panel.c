@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "panel.h"
+#include "panel_mock.h"
+#include "pax_gfx.h"
+
+// Host stand-in for the panel driver. Frames are drawn into a single buffer with the same raw
+// layout as on the device; instead of transferring regions to a panel it counts what would have
+// been sent, and can write every finished frame to a PPM file as the user would see it.
+
+static char const TAG[] = "panel_mock";
+
+static pax_buf_t          panel_buffer      = {0};
+static bool               panel_ready       = false;
+static size_t             panel_h_res       = 0;
+static size_t             panel_v_res       = 0;
+static pax_orientation_t  panel_orientation = PAX_O_UPRIGHT;
+static bool               panel_frame_open  = false;
+static char const*        dump_prefix       = NULL;
+static panel_mock_stats_t stats             = {0};
+
+static bool panel_rotated(void) {
+    return panel_orientation == PAX_O_ROT_CCW || panel_orientation == PAX_O_ROT_CW;
+}
+
+static void panel_dump_frame(void) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s%04llu.ppm", dump_prefix, (unsigned long long)stats.frames);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return;
+    }
+
+    int width  = panel_rotated() ? panel_v_res : panel_h_res;
+    int height = panel_rotated() ? panel_h_res : panel_v_res;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            pax_col_t color  = pax_get_pixel(&panel_buffer, x, y);
+            uint8_t   rgb[3] = {color >> 16, color >> 8, color};
+            fwrite(rgb, 1, sizeof(rgb), file);
+        }
+    }
+    fclose(file);
+}
+
+esp_err_t panel_init(esp_lcd_panel_handle_t panel, size_t h_res, size_t v_res, pax_buf_type_t format,
+                     pax_orientation_t orientation, bool reversed) {
+    (void)panel;
+    size_t bpp    = (format == PAX_BUF_16_565RGB) ? 2 : 3;
+    void*  pixels = heap_caps_calloc(h_res * v_res, bpp, MALLOC_CAP_SPIRAM);
+    if (pixels == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pax_buf_init(&panel_buffer, pixels, h_res, v_res, format);
+    pax_buf_reversed(&panel_buffer, reversed);
+    pax_buf_set_orientation(&panel_buffer, orientation);
+    panel_geometry_init(h_res, v_res, orientation);
+
+    panel_h_res       = h_res;
+    panel_v_res       = v_res;
+    panel_orientation = orientation;
+    panel_ready       = true;
+    return ESP_OK;
+}
+
+pax_buf_t* panel_begin_frame(void) {
+    if (!panel_ready) {
+        return NULL;
+    }
+    panel_frame_open = true;
+    return &panel_buffer;
+}
+
+esp_err_t panel_flush(int x, int y, int w, int h) {
+    if (!panel_frame_open) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (panel_to_raw(&x, &y, &w, &h)) {
+        stats.transfers++;
+        stats.pixels += (uint64_t)w * h;
+    }
+    return ESP_OK;
+}
+
+esp_err_t panel_flush_all(void) {
+    if (panel_rotated()) {
+        return panel_flush(0, 0, panel_v_res, panel_h_res);
+    }
+    return panel_flush(0, 0, panel_h_res, panel_v_res);
+}
+
+void panel_end_frame(void) {
+    if (!panel_frame_open) {
+        return;
+    }
+    panel_frame_open = false;
+    if (dump_prefix != NULL) {
+        panel_dump_frame();
+    }
+    stats.frames++;
+}
+
+// Write every following frame to <prefix>NNNN.ppm, or stop dumping when prefix is NULL
+void panel_mock_set_dump(char const* prefix) {
+    dump_prefix = prefix;
+}
+
+panel_mock_stats_t panel_mock_get_stats(void) {
+    return stats;
+}
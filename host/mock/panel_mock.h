@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t frames;
+    uint64_t transfers;
+    uint64_t pixels;  // Pixels that would have been sent to the panel
+} panel_mock_stats_t;
+
+void               panel_mock_set_dump(char const* prefix);
+panel_mock_stats_t panel_mock_get_stats(void);
@@ -0,0 +1,22 @@
+#include "render_scheduler.h"
+
+// Host stand-in for the render scheduler. The host programs render synchronously, so posted
+// changes are simply picked up by the next frame they draw.
+
+void render_scheduler_init(TaskHandle_t task) {
+    (void)task;
+}
+
+void render_scheduler_post(void) {
+}
+
+void render_scheduler_set_clock(bool enabled) {
+    (void)enabled;
+}
+
+void render_scheduler_set_clock_period(uint32_t seconds) {
+    (void)seconds;
+}
+
+void render_scheduler_wait(void) {
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Host stand-in for the ESP-IDF capability based allocator, all memory comes from the C heap
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DMA      (1 << 3)
+#define MALLOC_CAP_8BIT     (1 << 2)
+
+static inline void* heap_caps_malloc(size_t size, uint32_t caps) {
+    (void)caps;
+    return malloc(size);
+}
+
+static inline void* heap_caps_calloc(size_t count, size_t size, uint32_t caps) {
+    (void)caps;
+    return calloc(count, size);
+}
+
+static inline void heap_caps_free(void* ptr) {
+    free(ptr);
+}
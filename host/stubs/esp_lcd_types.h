@@ -0,0 +1,4 @@
+#pragma once
+
+// Host stand-in for the esp_lcd handle types, the host panel does not use a driver
+typedef struct esp_lcd_panel_t* esp_lcd_panel_handle_t;
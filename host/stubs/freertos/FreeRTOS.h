@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host stand-in for the FreeRTOS primitives used by the portable sources. The host programs are
+// single threaded, so critical sections compile to nothing.
+typedef uint32_t TickType_t;
+typedef int      portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define taskENTER_CRITICAL(lock)     ((void)(lock))
+#define taskEXIT_CRITICAL(lock)      ((void)(lock))
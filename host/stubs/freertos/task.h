@@ -0,0 +1,6 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+// Host stand-in for the FreeRTOS task API, tasks only exist as opaque handles
+typedef struct tskTaskControlBlock* TaskHandle_t;
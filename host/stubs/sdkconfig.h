@@ -0,0 +1,7 @@
+#pragma once
+
+// Host stand-in for the generated project configuration, optional features are left disabled and
+// settings the host build needs are at their defaults
+
+#define CONFIG_NOTIFIER_RX_RATE_PER_MIN 30
+#define CONFIG_NOTIFIER_RX_BURST        5
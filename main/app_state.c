@@ -0,0 +1,56 @@
+#include "app_state.h"
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+// State that several tasks write and the render task draws: the screen, the selection, the
+// status lines in the header. Writers take a short critical section among themselves and bump a
+// sequence number that is odd while they change the state. Readers never take the lock: they copy
+// the state and retry in the rare case that the copy raced with a writer. Half the sequence
+// number is the version, which changes with every update, so the render task only copies the
+// state when something changed since its last frame.
+
+static portMUX_TYPE         app_state_lock = portMUX_INITIALIZER_UNLOCKED;  // Between writers only
+static atomic_uint_fast32_t sequence       = 0;
+
+static app_state_t state = {
+    .screen            = UI_SCREEN_MAIN,
+    .connection_status = "Wi-Fi: Connecting",
+    .publish_status    = "",
+};
+
+// Changes go between begin and end, which run in a critical section: no logging or blocking calls
+app_state_t* app_state_begin_update(void) {
+    taskENTER_CRITICAL(&app_state_lock);
+    uint32_t current = atomic_load_explicit(&sequence, memory_order_relaxed);
+    atomic_store_explicit(&sequence, current + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return &state;
+}
+
+// Publishes the changes. Callers add their damage after this and only then wake the render task,
+// so the frame that picks the change up also redraws what it touched.
+void app_state_end_update(void) {
+    uint32_t current = atomic_load_explicit(&sequence, memory_order_relaxed);
+    atomic_store_explicit(&sequence, current + 1, memory_order_release);
+    taskEXIT_CRITICAL(&app_state_lock);
+}
+
+// Copies a consistent state and returns its version
+uint32_t app_state_read(app_state_t* out) {
+    while (true) {
+        uint32_t before = atomic_load_explicit(&sequence, memory_order_acquire);
+        if (before & 1) {
+            continue;  // A writer on the other core is halfway, that only takes a few instructions
+        }
+        memcpy(out, &state, sizeof(state));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&sequence, memory_order_relaxed) == before) {
+            return before / 2;
+        }
+    }
+}
+
+uint32_t app_state_version(void) {
+    return atomic_load_explicit(&sequence, memory_order_acquire) / 2;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "ui.h"
+
+#define APP_STATE_STATUS_LENGTH 32
+
+typedef struct {
+    ui_screen_t screen;
+    int         selected_button;
+    uint32_t    history_offset;  // Number of messages scrolled back from the newest
+    char        connection_status[APP_STATE_STATUS_LENGTH];
+    char const* publish_status;  // Delivery state of the last published event, a string literal
+    bool        sd_card_present;
+} app_state_t;
+
+app_state_t* app_state_begin_update(void);
+void         app_state_end_update(void);
+uint32_t     app_state_read(app_state_t* out);
+uint32_t     app_state_version(void);
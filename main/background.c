@@ -0,0 +1,84 @@
+#include "background.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "panel.h"
+#include "pax_gfx.h"
+
+// Persistent background layer kept in PSRAM in the same raw layout as the framebuffer, so
+// restoring part of the background is a plain row copy instead of a PNG decode.
+
+static char const TAG[] = "background";
+
+static pax_buf_t         layer             = {0};
+static uint8_t*          layer_pixels      = NULL;
+static bool              layer_valid       = false;
+static size_t            layer_h_res       = 0;
+static size_t            layer_v_res       = 0;
+static size_t            layer_bpp         = 0;
+static pax_buf_type_t    layer_format      = PAX_BUF_16_565RGB;
+static pax_orientation_t layer_orientation = PAX_O_UPRIGHT;
+static bool              layer_reversed    = false;
+
+// Returns true when the layer was (re)created and the caller has to draw the static content into it
+bool background_prepare(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation,
+                        bool reversed) {
+    if (layer_valid && layer_h_res == h_res && layer_v_res == v_res && layer_format == format &&
+        layer_orientation == orientation && layer_reversed == reversed) {
+        return false;
+    }
+
+    if (layer_valid) {
+        pax_buf_destroy(&layer);
+        layer_valid = false;
+    }
+
+    size_t bpp  = (format == PAX_BUF_16_565RGB) ? 2 : 3;
+    size_t size = h_res * v_res * bpp;
+    if (layer_pixels == NULL || layer_h_res * layer_v_res * layer_bpp != size) {
+        heap_caps_free(layer_pixels);
+        layer_pixels = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        if (layer_pixels == NULL) {
+            ESP_LOGE(TAG, "Failed to allocate %u bytes for the background layer", (unsigned)size);
+            return false;
+        }
+    }
+
+    pax_buf_init(&layer, layer_pixels, h_res, v_res, format);
+    pax_buf_reversed(&layer, reversed);
+    pax_buf_set_orientation(&layer, orientation);
+
+    layer_h_res       = h_res;
+    layer_v_res       = v_res;
+    layer_bpp         = bpp;
+    layer_format      = format;
+    layer_orientation = orientation;
+    layer_reversed    = reversed;
+    layer_valid       = true;
+    ESP_LOGI(TAG, "Background layer created (%ux%u)", (unsigned)h_res, (unsigned)v_res);
+    return true;
+}
+
+pax_buf_t* background_get_buffer(void) {
+    return layer_valid ? &layer : NULL;
+}
+
+// Copy a region of the layer (in oriented coordinates) into a framebuffer with the same layout
+bool background_restore(pax_buf_t* fb, int x, int y, int w, int h) {
+    if (!layer_valid) {
+        return false;
+    }
+    if (!panel_to_raw(&x, &y, &w, &h)) {
+        return true;
+    }
+
+    uint8_t*       dst    = pax_buf_get_pixels_rw(fb);
+    uint8_t const* src    = layer_pixels;
+    size_t         stride = layer_h_res * layer_bpp;
+    size_t         row    = w * layer_bpp;
+    for (int line = 0; line < h; line++) {
+        size_t offset = (y + line) * stride + x * layer_bpp;
+        memcpy(dst + offset, src + offset, row);
+    }
+    return true;
+}
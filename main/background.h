@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "pax_types.h"
+
+bool       background_prepare(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation,
+                              bool reversed);
+pax_buf_t* background_get_buffer(void);
+bool       background_restore(pax_buf_t* fb, int x, int y, int w, int h);
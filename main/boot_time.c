@@ -0,0 +1,29 @@
+#include "boot_time.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+
+// Startup timing. Each boot sequence times its own phases; milestones are logged once, relative
+// to the start of the application.
+
+static char const TAG[] = "boot";
+
+static char const* const milestone_names[BOOT_MILESTONE_COUNT] = {"first frame", "Wi-Fi connected",
+                                                                  "MQTT connected"};
+static volatile bool     milestone_logged[BOOT_MILESTONE_COUNT];
+
+// Logs how long a phase took, returns the start of the next phase
+int64_t boot_time_phase(char const* phase, int64_t start) {
+    int64_t now = esp_timer_get_time();
+    ESP_LOGI(TAG, "%s: %" PRId64 " ms (at %" PRId64 " ms)", phase, (now - start) / 1000, now / 1000);
+    return now;
+}
+
+void boot_time_milestone(boot_milestone_t milestone) {
+    if (milestone_logged[milestone]) {
+        return;
+    }
+    milestone_logged[milestone] = true;
+    ESP_LOGI(TAG, "Boot to %s: %" PRId64 " ms", milestone_names[milestone], esp_timer_get_time() / 1000);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    BOOT_MILESTONE_FIRST_FRAME,
+    BOOT_MILESTONE_WIFI_CONNECTED,
+    BOOT_MILESTONE_MQTT_CONNECTED,
+    BOOT_MILESTONE_COUNT
+} boot_milestone_t;
+
+int64_t boot_time_phase(char const* phase, int64_t start);
+void    boot_time_milestone(boot_milestone_t milestone);
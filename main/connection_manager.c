@@ -0,0 +1,219 @@
+#include "connection_manager.h"
+#include <string.h>
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "wifi_connection.h"
+#include "wifi_settings.h"
+
+// Keeps the station connected without user input. Driven by Wi-Fi and IP events: when the link
+// drops, the access point that worked last is tried directly on its cached BSSID and channel, which
+// skips the scan and usually reconnects within a second. Only when that fails is a full scan over
+// all configured networks done, and repeated failures back off exponentially with jitter. The cache
+// only points at a network in the wifi-manager store, the credentials are never copied out of it.
+
+#define CONNECTION_NAMESPACE      "wifi_cache"
+#define CONNECTION_KEY            "last_ap"
+#define CONNECTION_FAST_TIMEOUT   pdMS_TO_TICKS(2500)
+#define CONNECTION_BACKOFF_MIN_MS 250
+#define CONNECTION_BACKOFF_MAX_MS 30000
+
+#define EVENT_GOT_IP       (1 << 0)
+#define EVENT_DISCONNECTED (1 << 1)
+
+// Last access point that gave us an address
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t slot;  // Index of the network in the wifi-manager store
+} connection_cache_t;
+
+static char const TAG[] = "connection";
+
+static TaskHandle_t           connection_task     = NULL;
+static connection_status_cb_t connection_status   = NULL;
+static esp_netif_ip_info_t    connection_ip       = {0};
+static connection_cache_t     connection_cache    = {0};
+static bool                   connection_cache_ok = false;
+
+static void connection_event_handler(void* arg, esp_event_base_t base, int32_t id, void* data) {
+    if (connection_task == NULL) {
+        return;
+    }
+    if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        connection_ip = ((ip_event_got_ip_t*)data)->ip_info;
+        xTaskNotify(connection_task, EVENT_GOT_IP, eSetBits);
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        xTaskNotify(connection_task, EVENT_DISCONNECTED, eSetBits);
+    }
+}
+
+static void cache_load(void) {
+    nvs_handle_t handle;
+    if (nvs_open(CONNECTION_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    size_t    size      = sizeof(connection_cache);
+    esp_err_t res       = nvs_get_blob(handle, CONNECTION_KEY, &connection_cache, &size);
+    connection_cache_ok = res == ESP_OK && size == sizeof(connection_cache);
+    if (res != ESP_ERR_NVS_NOT_FOUND && !connection_cache_ok) {
+        // Earlier builds cached the credentials too, don't leave that copy of the password behind
+        nvs_erase_key(handle, CONNECTION_KEY);
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+// Finds the stored network the station is configured for
+static int find_slot(uint8_t const* ssid) {
+    wifi_settings_t settings;
+    for (int slot = 0; slot < WIFI_SETTINGS_MAX; slot++) {
+        if (wifi_settings_get(slot, &settings) == ESP_OK &&
+            strncmp((char const*)settings.ssid, (char const*)ssid, 32) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+static void cache_store(void) {
+    wifi_config_t    config;
+    wifi_ap_record_t ap;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK || esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+
+    int slot = find_slot(config.sta.ssid);
+    if (slot < 0) {
+        return;  // Not a stored network, there is nothing to reconnect to quickly
+    }
+
+    connection_cache_t cache = {0};
+    memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+    cache.channel = ap.primary;
+    cache.slot    = slot;
+    if (connection_cache_ok && memcmp(&cache, &connection_cache, sizeof(cache)) == 0) {
+        return;  // Spare the flash
+    }
+
+    nvs_handle_t handle;
+    if (nvs_open(CONNECTION_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(handle, CONNECTION_KEY, &cache, sizeof(cache)) == ESP_OK && nvs_commit(handle) == ESP_OK) {
+        connection_cache    = cache;
+        connection_cache_ok = true;
+        ESP_LOGI(TAG, "Cached %.32s on channel %u", (char const*)config.sta.ssid, cache.channel);
+    }
+    nvs_close(handle);
+}
+
+// Waits for the outcome of a connection attempt
+static bool wait_for_ip(TickType_t timeout) {
+    uint32_t events = 0;
+    while (xTaskNotifyWait(0, EVENT_GOT_IP | EVENT_DISCONNECTED, &events, timeout) == pdTRUE) {
+        if (events & EVENT_GOT_IP) {
+            return true;
+        }
+        if (events & EVENT_DISCONNECTED) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Connect to the cached access point without scanning. A network that was edited or removed from
+// the store since then just fails here and is found again by the scan.
+static bool connect_fast(void) {
+    wifi_settings_t settings;
+    if (!connection_cache_ok || wifi_settings_get(connection_cache.slot, &settings) != ESP_OK) {
+        return false;
+    }
+
+    wifi_config_t config = {0};
+    memcpy(config.sta.ssid, settings.ssid, sizeof(config.sta.ssid));
+    memcpy(config.sta.password, settings.password, sizeof(config.sta.password));
+    memcpy(config.sta.bssid, connection_cache.bssid, sizeof(config.sta.bssid));
+    config.sta.bssid_set   = true;
+    config.sta.channel     = connection_cache.channel;
+    config.sta.scan_method = WIFI_FAST_SCAN;
+
+    ulTaskNotifyValueClear(NULL, UINT32_MAX);
+    if (esp_wifi_set_config(WIFI_IF_STA, &config) != ESP_OK || esp_wifi_connect() != ESP_OK) {
+        return false;
+    }
+    return wait_for_ip(CONNECTION_FAST_TIMEOUT);
+}
+
+// Scan and try every configured network
+static bool connect_scan(void) {
+    wifi_connect_try_all();
+    return wifi_connection_is_connected();
+}
+
+static void set_state(bool connected) {
+    if (connection_status != NULL) {
+        connection_status(connected, connected ? &connection_ip : NULL);
+    }
+}
+
+static void connection_manager_task(void* pvParameters) {
+    uint32_t backoff_ms = 0;
+    cache_load();
+
+    while (1) {
+        bool connected = connect_fast();
+        if (connected) {
+            ESP_LOGI(TAG, "Connected to the cached access point without scanning");
+        } else if (connect_scan()) {
+            // Failed attempts of the scan leave disconnect events behind, only a drop from here on counts
+            ulTaskNotifyValueClear(NULL, UINT32_MAX);
+            connected = wifi_connection_is_connected();
+        }
+
+        if (!connected) {
+            // Exponential backoff with jitter on the upper half, so badges that lost the same AP do not retry in lockstep
+            backoff_ms        = backoff_ms == 0 ? CONNECTION_BACKOFF_MIN_MS : backoff_ms * 2;
+            backoff_ms        = backoff_ms > CONNECTION_BACKOFF_MAX_MS ? CONNECTION_BACKOFF_MAX_MS : backoff_ms;
+            uint32_t delay_ms = backoff_ms / 2 + esp_random() % (backoff_ms / 2 + 1);
+            ESP_LOGW(TAG, "Connection failed, retrying in %lu ms", (unsigned long)delay_ms);
+            vTaskDelay(pdMS_TO_TICKS(delay_ms));
+            continue;
+        }
+
+        backoff_ms = 0;
+        cache_store();
+        set_state(true);
+
+        // Connected, sleep until the link drops
+        uint32_t events = 0;
+        do {
+            xTaskNotifyWait(0, EVENT_GOT_IP | EVENT_DISCONNECTED, &events, portMAX_DELAY);
+        } while (!(events & EVENT_DISCONNECTED));
+
+        ESP_LOGW(TAG, "Connection lost");
+        set_state(false);
+    }
+}
+
+esp_err_t connection_manager_start(connection_status_cb_t status_cb) {
+    connection_status = status_cb;
+
+    // Register first so the outcome of the very first attempt can't be missed
+    esp_err_t res = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, connection_event_handler, NULL);
+    if (res == ESP_OK) {
+        res = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, connection_event_handler, NULL);
+    }
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    if (xTaskCreate(connection_manager_task, "connection_task", 4096, NULL, 9, &connection_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+// Called from the connection manager task on every change; ip is NULL when the link went down
+typedef void (*connection_status_cb_t)(bool connected, esp_netif_ip_info_t const* ip);
+
+esp_err_t connection_manager_start(connection_status_cb_t status_cb);
@@ -0,0 +1,114 @@
+#include "damage.h"
+#include "freertos/FreeRTOS.h"
+
+// Regions of the (oriented) framebuffer that have been invalidated since the last frame.
+// Overlapping or touching regions are merged on insertion so the list stays small; when the
+// list is full the new region is merged into whichever entry grows the least.
+
+static portMUX_TYPE  damage_lock = portMUX_INITIALIZER_UNLOCKED;
+static damage_rect_t damage_rects[DAMAGE_MAX_RECTS];
+static size_t        damage_count  = 0;
+static int           damage_width  = 0;
+static int           damage_height = 0;
+
+static damage_rect_t rect_union(damage_rect_t const* a, damage_rect_t const* b) {
+    int x0 = a->x < b->x ? a->x : b->x;
+    int y0 = a->y < b->y ? a->y : b->y;
+    int x1 = (a->x + a->w) > (b->x + b->w) ? (a->x + a->w) : (b->x + b->w);
+    int y1 = (a->y + a->h) > (b->y + b->h) ? (a->y + a->h) : (b->y + b->h);
+    return (damage_rect_t){x0, y0, x1 - x0, y1 - y0};
+}
+
+static bool rect_touches(damage_rect_t const* a, damage_rect_t const* b) {
+    return a->x <= b->x + b->w && b->x <= a->x + a->w && a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static int rect_area(damage_rect_t const* rect) {
+    return rect->w * rect->h;
+}
+
+bool damage_intersects(damage_rect_t const* a, damage_rect_t const* b) {
+    return a->x < b->x + b->w && b->x < a->x + a->w && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+void damage_init(int width, int height) {
+    taskENTER_CRITICAL(&damage_lock);
+    damage_width  = width;
+    damage_height = height;
+    damage_count  = 0;
+    taskEXIT_CRITICAL(&damage_lock);
+}
+
+void damage_add(int x, int y, int w, int h) {
+    // Clip to the framebuffer
+    if (x < 0) {
+        w += x;
+        x  = 0;
+    }
+    if (y < 0) {
+        h += y;
+        y  = 0;
+    }
+    if (x + w > damage_width) w = damage_width - x;
+    if (y + h > damage_height) h = damage_height - y;
+    if (w <= 0 || h <= 0) return;
+
+    damage_rect_t rect = {x, y, w, h};
+
+    taskENTER_CRITICAL(&damage_lock);
+
+    // Absorb every region the new one touches; repeat since the union may reach further
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < damage_count; i++) {
+            if (rect_touches(&rect, &damage_rects[i])) {
+                rect            = rect_union(&rect, &damage_rects[i]);
+                damage_rects[i] = damage_rects[damage_count - 1];
+                damage_count--;
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    if (damage_count < DAMAGE_MAX_RECTS) {
+        damage_rects[damage_count++] = rect;
+    } else {
+        size_t best      = 0;
+        int    best_cost = 0;
+        for (size_t i = 0; i < damage_count; i++) {
+            damage_rect_t joined = rect_union(&rect, &damage_rects[i]);
+            int           cost   = rect_area(&joined) - rect_area(&damage_rects[i]);
+            if (i == 0 || cost < best_cost) {
+                best      = i;
+                best_cost = cost;
+            }
+        }
+        damage_rects[best] = rect_union(&rect, &damage_rects[best]);
+    }
+
+    taskEXIT_CRITICAL(&damage_lock);
+}
+
+void damage_add_all(void) {
+    taskENTER_CRITICAL(&damage_lock);
+    damage_rects[0] = (damage_rect_t){0, 0, damage_width, damage_height};
+    damage_count    = 1;
+    taskEXIT_CRITICAL(&damage_lock);
+}
+
+bool damage_pending(void) {
+    return damage_count > 0;
+}
+
+size_t damage_take(damage_rect_t* out, size_t max) {
+    taskENTER_CRITICAL(&damage_lock);
+    size_t count = damage_count < max ? damage_count : max;
+    for (size_t i = 0; i < count; i++) {
+        out[i] = damage_rects[i];
+    }
+    damage_count = 0;
+    taskEXIT_CRITICAL(&damage_lock);
+    return count;
+}
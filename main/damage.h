@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Maximum number of disjoint regions tracked before they are merged
+#define DAMAGE_MAX_RECTS 8
+
+typedef struct {
+    int x;
+    int y;
+    int w;
+    int h;
+} damage_rect_t;
+
+void   damage_init(int width, int height);
+void   damage_add(int x, int y, int w, int h);
+void   damage_add_all(void);
+bool   damage_pending(void);
+size_t damage_take(damage_rect_t* out, size_t max);
+bool   damage_intersects(damage_rect_t const* a, damage_rect_t const* b);
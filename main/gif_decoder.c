@@ -0,0 +1,347 @@
+#include "gif_decoder.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Streaming GIF decoder. Frames are read straight from the file one LZW data sub-block at a
+// time and composited into a caller supplied 16 bit canvas, so neither the file nor a frame of
+// palette indices is ever held in memory. Plain C on top of stdio, it builds for the host as well.
+
+#define GIF_BLOCK_EXTENSION  0x21
+#define GIF_BLOCK_IMAGE      0x2C
+#define GIF_BLOCK_TRAILER    0x3B
+#define GIF_EXT_GRAPHICS     0xF9
+#define GIF_EXT_APPLICATION  0xFF
+#define GIF_DISPOSE_NONE     0
+#define GIF_DISPOSE_CLEAR    2
+#define GIF_DISPOSE_PREVIOUS 3
+#define GIF_DEFAULT_DELAY_MS 100  // What browsers use for frames of 10 ms and less, which clips rely on
+
+static bool read_bytes(gif_t* gif, void* out, size_t length) {
+    return fread(out, 1, length, gif->file) == length;
+}
+
+static int read_byte(gif_t* gif) {
+    return fgetc(gif->file);
+}
+
+static uint16_t read_le16(uint8_t const* data) {
+    return data[0] | (data[1] << 8);
+}
+
+static bool skip_sub_blocks(gif_t* gif) {
+    int length;
+    while ((length = read_byte(gif)) > 0) {
+        if (fseek(gif->file, length, SEEK_CUR) != 0) return false;
+    }
+    return length == 0;
+}
+
+static bool read_palette(gif_t* gif, uint16_t* palette, size_t count) {
+    uint8_t rgb[3 * 256];
+    if (!read_bytes(gif, rgb, 3 * count)) return false;
+    for (size_t i = 0; i < count; i++) {
+        uint16_t color = ((rgb[3 * i] >> 3) << 11) | ((rgb[3 * i + 1] >> 2) << 5) | (rgb[3 * i + 2] >> 3);
+        palette[i]     = gif->target.swap_bytes ? (uint16_t)((color >> 8) | (color << 8)) : color;
+    }
+    return true;
+}
+
+// Index into the canvas of a pixel in GIF coordinates, -1 when it lies outside the visible window
+static inline int32_t canvas_index(gif_target_t const* target, int x, int y) {
+    x -= target->clip_x;
+    y -= target->clip_y;
+    if (x < 0 || y < 0 || x >= target->clip_w || y >= target->clip_h) return -1;
+    return target->origin + x * target->x_step + y * target->y_step;
+}
+
+static void fill_area(gif_t* gif, int x, int y, int w, int h, uint16_t color) {
+    for (int line = y; line < y + h; line++) {
+        for (int column = x; column < x + w; column++) {
+            int32_t index = canvas_index(&gif->target, column, line);
+            if (index >= 0) gif->target.pixels[index] = color;
+        }
+    }
+}
+
+static void clear_canvas(gif_t* gif) {
+    if (gif->target.pixels != NULL) {
+        fill_area(gif, 0, 0, gif->width, gif->height, 0);
+    }
+    gif->dispose = GIF_DISPOSE_NONE;
+}
+
+// Copies the area a frame is drawn over between the canvas and the save buffer
+static bool save_area(gif_t* gif, int x, int y, int w, int h, bool restore) {
+    size_t size = (size_t)w * h;
+    if (!restore && size > gif->saved_size) {
+        uint16_t* saved = realloc(gif->saved, size * sizeof(uint16_t));
+        if (saved == NULL) return false;
+        gif->saved      = saved;
+        gif->saved_size = size;
+    }
+    uint16_t* slot = gif->saved;
+    for (int line = y; line < y + h; line++) {
+        for (int column = x; column < x + w; column++, slot++) {
+            int32_t index = canvas_index(&gif->target, column, line);
+            if (index < 0) continue;
+            if (restore) {
+                gif->target.pixels[index] = *slot;
+            } else {
+                *slot = gif->target.pixels[index];
+            }
+        }
+    }
+    return true;
+}
+
+static void apply_disposal(gif_t* gif) {
+    if (gif->dispose == GIF_DISPOSE_CLEAR) {
+        fill_area(gif, gif->dispose_x, gif->dispose_y, gif->dispose_w, gif->dispose_h, 0);
+    } else if (gif->dispose == GIF_DISPOSE_PREVIOUS && gif->saved != NULL) {
+        save_area(gif, gif->dispose_x, gif->dispose_y, gif->dispose_w, gif->dispose_h, true);
+    }
+    gif->dispose = GIF_DISPOSE_NONE;
+}
+
+bool gif_open(gif_t* gif, FILE* file) {
+    memset(gif, 0, sizeof(*gif));
+    gif->file = file;
+
+    uint8_t header[13];
+    if (!read_bytes(gif, header, sizeof(header)) || memcmp(header, "GIF8", 4) != 0) {
+        return false;
+    }
+    gif->width  = read_le16(&header[6]);
+    gif->height = read_le16(&header[8]);
+    if (header[10] & 0x80) {
+        gif->has_global_palette = true;
+        if (!read_palette(gif, gif->global_palette, 2u << (header[10] & 0x07))) return false;
+    }
+    gif->first_frame = ftell(file);
+    return gif->width > 0 && gif->height > 0 && gif->first_frame > 0;
+}
+
+// The palette is converted while it is read, so it is read again for the new byte order
+void gif_set_target(gif_t* gif, gif_target_t const* target) {
+    gif->target = *target;
+    if (gif->has_global_palette) {
+        uint8_t flags = 0;
+        fseek(gif->file, 10, SEEK_SET);
+        flags = read_byte(gif);
+        fseek(gif->file, 13, SEEK_SET);
+        read_palette(gif, gif->global_palette, 2u << (flags & 0x07));
+    }
+    gif_rewind(gif);
+}
+
+bool gif_rewind(gif_t* gif) {
+    gif->frame_index = 0;
+    clear_canvas(gif);
+    return fseek(gif->file, gif->first_frame, SEEK_SET) == 0;
+}
+
+void gif_close(gif_t* gif) {
+    free(gif->saved);
+    gif->saved      = NULL;
+    gif->saved_size = 0;
+}
+
+// Reads the next LZW code of the given width from the image data sub-blocks, -1 at the end
+static int read_code(gif_t* gif, uint8_t width) {
+    while (gif->bit_count < width) {
+        if (gif->block_position == gif->block_length) {
+            int length = gif->blocks_done ? 0 : read_byte(gif);
+            if (length <= 0 || !read_bytes(gif, gif->block, length)) {
+                gif->blocks_done = true;
+                return -1;
+            }
+            gif->block_length   = length;
+            gif->block_position = 0;
+        }
+        gif->bits      |= (uint32_t)gif->block[gif->block_position++] << gif->bit_count;
+        gif->bit_count += 8;
+    }
+    int code        = gif->bits & ((1u << width) - 1);
+    gif->bits     >>= width;
+    gif->bit_count -= width;
+    return code;
+}
+
+typedef struct {
+    int             x, y, w, h;
+    bool            interlaced;
+    int             transparent;
+    uint16_t const* palette;
+    int             column;
+    int             row;
+    int             pass;
+} gif_cursor_t;
+
+// Row order of interlaced images: every 8th row from 0, every 8th from 4, every 4th from 2, the rest
+static void next_row(gif_cursor_t* cursor) {
+    static uint8_t const starts[] = {0, 4, 2, 1};
+    static uint8_t const steps[]  = {8, 8, 4, 2};
+    if (!cursor->interlaced) {
+        cursor->row++;
+        return;
+    }
+    cursor->row += steps[cursor->pass];
+    while (cursor->row >= cursor->h && cursor->pass < 3) {
+        cursor->pass++;
+        cursor->row = starts[cursor->pass];
+    }
+}
+
+static void put_pixels(gif_t* gif, gif_cursor_t* cursor, uint8_t const* indices, size_t count) {
+    for (size_t i = 0; i < count && cursor->row < cursor->h; i++) {
+        if (indices[i] != cursor->transparent) {
+            int32_t index = canvas_index(&gif->target, cursor->x + cursor->column, cursor->y + cursor->row);
+            if (index >= 0) gif->target.pixels[index] = cursor->palette[indices[i]];
+        }
+        if (++cursor->column == cursor->w) {
+            cursor->column = 0;
+            next_row(cursor);
+        }
+    }
+}
+
+static bool decode_image(gif_t* gif, gif_cursor_t* cursor) {
+    int min_size = read_byte(gif);
+    if (min_size < 2 || min_size > 8) return false;
+
+    int const clear      = 1 << min_size;
+    int const end        = clear + 1;
+    int       next       = clear + 2;
+    uint8_t   width      = min_size + 1;
+    int       previous   = -1;
+    uint8_t   first_byte = 0;
+
+    gif->block_length = gif->block_position = 0;
+    gif->blocks_done                        = false;
+    gif->bits = gif->bit_count = 0;
+
+    for (int i = 0; i < clear; i++) {
+        gif->prefix[i] = 0;
+        gif->suffix[i] = i;
+    }
+
+    int code;
+    while ((code = read_code(gif, width)) >= 0 && code != end) {
+        if (code == clear) {
+            next     = clear + 2;
+            width    = min_size + 1;
+            previous = -1;
+            continue;
+        }
+        if (previous < 0) {
+            if (code >= clear) return false;
+            first_byte = code;
+            put_pixels(gif, cursor, &first_byte, 1);
+            previous = code;
+            continue;
+        }
+
+        // Walk the string back to front; a code that is not in the table yet is the previous string
+        // plus its own first byte
+        size_t depth = GIF_LZW_CODES;
+        int    walk  = code;
+        if (code >= next) {
+            if (code > next) return false;
+            gif->stack[--depth] = first_byte;
+            walk                = previous;
+        }
+        while (walk >= clear) {
+            if (depth == 1) return false;
+            gif->stack[--depth] = gif->suffix[walk];
+            walk                = gif->prefix[walk];
+        }
+        gif->stack[--depth] = walk;
+        first_byte          = walk;
+        put_pixels(gif, cursor, &gif->stack[depth], GIF_LZW_CODES - depth);
+
+        if (next < GIF_LZW_CODES) {
+            gif->prefix[next] = previous;
+            gif->suffix[next] = first_byte;
+            next++;
+            if (next == (1 << width) && width < 12) width++;
+        }
+        previous = code;
+    }
+
+    // Skip the sub-blocks left after the end code, up to the terminator
+    return gif->blocks_done || skip_sub_blocks(gif);
+}
+
+gif_result_t gif_next_frame(gif_t* gif, uint32_t* delay_ms) {
+    uint8_t  dispose     = GIF_DISPOSE_NONE;
+    int      transparent = -1;
+    uint32_t delay       = 0;
+
+    while (1) {
+        int type = read_byte(gif);
+        if (type == GIF_BLOCK_TRAILER || type == EOF) {
+            return GIF_END;
+        }
+
+        if (type == GIF_BLOCK_EXTENSION) {
+            int     label = read_byte(gif);
+            uint8_t data[16];
+            int     length = read_byte(gif);
+            if (length < 0) return GIF_ERROR;
+            if (label == GIF_EXT_GRAPHICS && length == 4) {
+                if (!read_bytes(gif, data, 4)) return GIF_ERROR;
+                dispose     = (data[0] >> 2) & 0x07;
+                transparent = (data[0] & 0x01) ? data[3] : -1;
+                delay       = read_le16(&data[1]) * 10;
+            } else if (label == GIF_EXT_APPLICATION && length == 11) {
+                // NETSCAPE2.0 carries the loop count
+                if (!read_bytes(gif, data, 11)) return GIF_ERROR;
+                if (memcmp(data, "NETSCAPE2.0", 11) == 0) {
+                    length = read_byte(gif);
+                    if (length != 3 || !read_bytes(gif, data, 3)) return GIF_ERROR;
+                    gif->loop_count = read_le16(&data[1]);
+                }
+            } else if (length > 0 && fseek(gif->file, length, SEEK_CUR) != 0) {
+                return GIF_ERROR;
+            }
+            if (!skip_sub_blocks(gif)) return GIF_ERROR;
+            continue;
+        }
+
+        if (type != GIF_BLOCK_IMAGE) {
+            return GIF_ERROR;
+        }
+
+        uint8_t descriptor[9];
+        if (!read_bytes(gif, descriptor, sizeof(descriptor))) return GIF_ERROR;
+        gif_cursor_t cursor = {
+            .x           = read_le16(&descriptor[0]),
+            .y           = read_le16(&descriptor[2]),
+            .w           = read_le16(&descriptor[4]),
+            .h           = read_le16(&descriptor[6]),
+            .interlaced  = descriptor[8] & 0x40,
+            .transparent = transparent,
+            .palette     = gif->global_palette,
+        };
+        if (descriptor[8] & 0x80) {
+            if (!read_palette(gif, gif->local_palette, 2u << (descriptor[8] & 0x07))) return GIF_ERROR;
+            cursor.palette = gif->local_palette;
+        }
+
+        apply_disposal(gif);
+        if (dispose == GIF_DISPOSE_PREVIOUS && !save_area(gif, cursor.x, cursor.y, cursor.w, cursor.h, false)) {
+            dispose = GIF_DISPOSE_CLEAR;  // Out of memory, clearing is the closest we can do
+        }
+        if (!decode_image(gif, &cursor)) return GIF_ERROR;
+
+        gif->dispose   = dispose;
+        gif->dispose_x = cursor.x;
+        gif->dispose_y = cursor.y;
+        gif->dispose_w = cursor.w;
+        gif->dispose_h = cursor.h;
+        gif->frame_index++;
+
+        *delay_ms = delay <= 10 ? GIF_DEFAULT_DELAY_MS : delay;
+        return GIF_FRAME;
+    }
+}
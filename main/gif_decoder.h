@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define GIF_LZW_CODES 4096
+
+// Where decoded frames are composited: a 16 bit canvas in any pixel order. Pixel (x, y) of the
+// visible window lands at pixels[origin + (x - clip_x) * x_step + (y - clip_y) * y_step], so a
+// canvas can already be in the rotated layout of the framebuffer.
+typedef struct {
+    uint16_t* pixels;
+    int32_t   origin;
+    int32_t   x_step;
+    int32_t   y_step;
+    int       clip_x;
+    int       clip_y;
+    int       clip_w;
+    int       clip_h;
+    bool      swap_bytes;  // Store colors big endian
+} gif_target_t;
+
+typedef struct {
+    FILE*        file;
+    gif_target_t target;
+    uint16_t     width;
+    uint16_t     height;
+    uint16_t     loop_count;  // 0 loops forever
+    long         first_frame;
+    uint32_t     frame_index;
+
+    uint16_t global_palette[256];
+    uint16_t local_palette[256];
+    bool     has_global_palette;
+
+    // Disposal of the previous frame, applied before the next one is drawn
+    uint8_t   dispose;
+    uint16_t  dispose_x, dispose_y, dispose_w, dispose_h;
+    uint16_t* saved;
+    size_t    saved_size;
+
+    // LZW string table and bit reader
+    uint16_t prefix[GIF_LZW_CODES];
+    uint8_t  suffix[GIF_LZW_CODES];
+    uint8_t  stack[GIF_LZW_CODES];
+    uint8_t  block[255];
+    uint8_t  block_length;
+    uint8_t  block_position;
+    bool     blocks_done;
+    uint32_t bits;
+    uint8_t  bit_count;
+} gif_t;
+
+typedef enum {
+    GIF_FRAME,
+    GIF_END,
+    GIF_ERROR,
+} gif_result_t;
+
+bool         gif_open(gif_t* gif, FILE* file);
+void         gif_set_target(gif_t* gif, gif_target_t const* target);
+gif_result_t gif_next_frame(gif_t* gif, uint32_t* delay_ms);
+bool         gif_rewind(gif_t* gif);
+void         gif_close(gif_t* gif);
@@ -0,0 +1,431 @@
+#include "gif_player.h"
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "gif_decoder.h"
+#include "pax_gfx.h"
+#include "panel.h"
+#include "power.h"
+#include "render_scheduler.h"
+#include "ui.h"
+
+// Plays GIF files from the SD card full screen. Frames are decoded straight from the file into a
+// canvas in PSRAM that is already in the raw layout of the framebuffer, so showing a frame is a
+// row copy done by the render task. Frames are paced by their own delays against absolute
+// deadlines. Decoded frames of clips that fit the cache budget are kept in an LRU cache, so short
+// looping clips play from PSRAM after the first loop without touching the card.
+
+#define GIF_PATH_LENGTH        96
+#define GIF_QUEUE_LENGTH       2
+#define GIF_CACHE_SLOTS        64
+#define GIF_CACHE_BYTES        (CONFIG_NOTIFIER_GIF_CACHE_KB * 1024)
+#define GIF_FILE_BUFFER        16384
+#define GIF_PRESENT_TIMEOUT_MS 500  // The render task took the frame by then, unless the screen changed
+
+typedef struct {
+    uint32_t  clip;    // 0 for a free slot
+    uint16_t  frame;
+    uint16_t  frames;  // Frames in the clip, 0 until the first loop completed
+    uint32_t  delay_ms;
+    uint32_t  used;    // Last use, for the LRU order
+    size_t    size;
+    uint16_t* pixels;
+} gif_cache_entry_t;
+
+static char const TAG[] = "gif_player";
+
+static QueueHandle_t     request_queue  = NULL;
+static TaskHandle_t      player_task    = NULL;
+static SemaphoreHandle_t frame_consumed = NULL;
+static volatile bool     playing        = false;
+static volatile bool     stop_requested = false;
+
+static size_t            screen_h_res       = 0;
+static size_t            screen_v_res       = 0;
+static pax_orientation_t screen_orientation = PAX_O_UPRIGHT;
+static bool              screen_reversed    = false;
+
+// Where the clip is shown, in oriented and raw panel coordinates
+static int view_x, view_y, view_w, view_h;
+static int raw_x, raw_y, raw_w, raw_h;
+
+// Frame handed to the render task, in raw layout
+static uint16_t const* volatile shown_pixels  = NULL;
+static volatile bool            frame_pending = false;
+
+static gif_cache_entry_t cache[GIF_CACHE_SLOTS];
+static size_t            cache_bytes = 0;
+static uint32_t          cache_clock = 0;
+
+// Identifies a clip by its path, size and modification time, so a replaced file is not served from the cache
+static uint32_t clip_id(char const* path, struct stat const* info) {
+    uint32_t hash = 2166136261u;
+    for (char const* c = path; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    hash ^= (uint32_t)info->st_size * 2654435761u;
+    hash ^= (uint32_t)info->st_mtime;
+    return hash != 0 ? hash : 1;
+}
+
+static gif_cache_entry_t* cache_find(uint32_t clip, uint16_t frame) {
+    for (size_t i = 0; i < GIF_CACHE_SLOTS; i++) {
+        if (cache[i].clip == clip && cache[i].frame == frame) {
+            cache[i].used = ++cache_clock;
+            return &cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void cache_free(gif_cache_entry_t* entry) {
+    heap_caps_free(entry->pixels);
+    cache_bytes -= entry->size;
+    memset(entry, 0, sizeof(*entry));
+}
+
+static void cache_drop_clip(uint32_t clip) {
+    for (size_t i = 0; i < GIF_CACHE_SLOTS; i++) {
+        if (cache[i].clip == clip) cache_free(&cache[i]);
+    }
+}
+
+// Number of frames when all frames of a clip are cached, 0 otherwise. Complete once a loop was
+// decoded and nothing of it was evicted since.
+static uint16_t cache_complete(uint32_t clip) {
+    gif_cache_entry_t* first = cache_find(clip, 0);
+    if (first == NULL || first->frames == 0) return 0;
+    for (uint16_t frame = 1; frame < first->frames; frame++) {
+        if (cache_find(clip, frame) == NULL) return 0;
+    }
+    return first->frames;
+}
+
+static void cache_set_frames(uint32_t clip, uint16_t frames) {
+    for (size_t i = 0; i < GIF_CACHE_SLOTS; i++) {
+        if (cache[i].clip == clip) cache[i].frames = frames;
+    }
+}
+
+// Evicts least recently used frames of other clips until the frame fits. A clip that does not fit
+// the budget on its own is not cached at all: caching it would only evict its own frames before
+// they are played again.
+static bool cache_insert(uint32_t clip, uint16_t frame, uint32_t delay_ms, uint16_t const* pixels) {
+    size_t size = (size_t)raw_w * raw_h * sizeof(uint16_t);
+    if (size > GIF_CACHE_BYTES) return false;
+
+    gif_cache_entry_t* slot = NULL;
+    while (slot == NULL || cache_bytes + size > GIF_CACHE_BYTES) {
+        gif_cache_entry_t* oldest = NULL;
+        slot                      = NULL;
+        for (size_t i = 0; i < GIF_CACHE_SLOTS; i++) {
+            if (cache[i].clip == 0) {
+                slot = slot != NULL ? slot : &cache[i];
+            } else if (oldest == NULL || cache[i].used < oldest->used) {
+                oldest = &cache[i];
+            }
+        }
+        if (slot != NULL && cache_bytes + size <= GIF_CACHE_BYTES) break;
+        if (oldest == NULL || oldest->clip == clip) return false;
+        cache_free(oldest);
+    }
+
+    slot->pixels = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (slot->pixels == NULL) return false;
+    memcpy(slot->pixels, pixels, size);
+    slot->clip     = clip;
+    slot->frame    = frame;
+    slot->delay_ms = delay_ms;
+    slot->used     = ++cache_clock;
+    slot->size     = size;
+    cache_bytes   += size;
+    return true;
+}
+
+// Centers the clip on the screen, cropping what does not fit, and maps it onto the raw canvas
+static bool place_clip(gif_t const* gif, gif_target_t* target) {
+    bool   rotated  = screen_orientation == PAX_O_ROT_CCW || screen_orientation == PAX_O_ROT_CW;
+    int    screen_w = rotated ? screen_v_res : screen_h_res;
+    int    screen_h = rotated ? screen_h_res : screen_v_res;
+    int    left     = (screen_w - gif->width) / 2;
+    int    top      = (screen_h - gif->height) / 2;
+    size_t clip_x   = left < 0 ? -left : 0;
+    size_t clip_y   = top < 0 ? -top : 0;
+
+    view_x = left + clip_x;
+    view_y = top + clip_y;
+    view_w = gif->width - 2 * clip_x;
+    view_h = gif->height - 2 * clip_y;
+    if (view_w > screen_w) view_w = screen_w;
+    if (view_h > screen_h) view_h = screen_h;
+
+    raw_x = view_x;
+    raw_y = view_y;
+    raw_w = view_w;
+    raw_h = view_h;
+    if (!panel_to_raw(&raw_x, &raw_y, &raw_w, &raw_h)) return false;
+
+    // Step through the raw canvas the way panel_to_raw maps the oriented axes
+    *target = (gif_target_t){
+        .clip_x     = clip_x,
+        .clip_y     = clip_y,
+        .clip_w     = view_w,
+        .clip_h     = view_h,
+        .swap_bytes = screen_reversed,
+    };
+    switch (screen_orientation) {
+        case PAX_O_ROT_CCW:
+            target->origin = (raw_h - 1) * raw_w;
+            target->x_step = -raw_w;
+            target->y_step = 1;
+            break;
+        case PAX_O_ROT_HALF:
+            target->origin = raw_h * raw_w - 1;
+            target->x_step = -1;
+            target->y_step = -raw_w;
+            break;
+        case PAX_O_ROT_CW:
+            target->origin = raw_w - 1;
+            target->x_step = raw_w;
+            target->y_step = -1;
+            break;
+        case PAX_O_UPRIGHT:
+        default:
+            target->origin = 0;
+            target->x_step = 1;
+            target->y_step = raw_w;
+            break;
+    }
+    return true;
+}
+
+// Called from the render task while the animation screen is shown
+void gif_player_draw(pax_buf_t* fb) {
+    if (!frame_pending) {
+        return;
+    }
+
+    uint16_t*       dst = pax_buf_get_pixels_rw(fb);
+    uint16_t const* src = shown_pixels;
+    for (int line = 0; line < raw_h; line++) {
+        memcpy(dst + (raw_y + line) * screen_h_res + raw_x, src + line * raw_w, raw_w * sizeof(uint16_t));
+    }
+    panel_flush(view_x, view_y, view_w, view_h);
+
+    frame_pending = false;
+    xSemaphoreGive(frame_consumed);
+}
+
+// Hands a frame to the render task and waits until it was copied out, after that the pixels may change
+static bool present(uint16_t const* pixels) {
+    xSemaphoreTake(frame_consumed, 0);
+    shown_pixels  = pixels;
+    frame_pending = true;
+    render_scheduler_post();
+    if (xSemaphoreTake(frame_consumed, pdMS_TO_TICKS(GIF_PRESENT_TIMEOUT_MS)) != pdTRUE) {
+        frame_pending = false;
+        return false;
+    }
+    return true;
+}
+
+// Sleeps until the deadline, a stop request ends the wait early
+static void wait_until(int64_t deadline) {
+    int64_t remaining = deadline - esp_timer_get_time();
+    if (remaining > 0) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((remaining + 999) / 1000));
+    }
+}
+
+static void play(char const* path) {
+    static gif_t gif;
+
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        ESP_LOGD(TAG, "No animation at %s", path);
+        return;
+    }
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return;
+    }
+    setvbuf(file, NULL, _IOFBF, GIF_FILE_BUFFER);
+
+    gif_target_t target;
+    uint16_t*    canvas = NULL;
+    if (!gif_open(&gif, file) || !place_clip(&gif, &target)) {
+        ESP_LOGW(TAG, "%s is not a GIF that can be shown", path);
+        fclose(file);
+        return;
+    }
+    canvas = heap_caps_malloc((size_t)raw_w * raw_h * sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+    if (canvas == NULL) {
+        ESP_LOGE(TAG, "No memory for a %ux%u canvas", gif.width, gif.height);
+        fclose(file);
+        return;
+    }
+    target.pixels = canvas;
+    gif_set_target(&gif, &target);
+
+    uint32_t clip      = clip_id(path, &info);
+    uint16_t frames    = cache_complete(clip);
+    bool     cached    = frames > 0;
+    bool     cacheable = !cached;
+    if (!cached) {
+        cache_drop_clip(clip);  // Left over from a partly cached earlier play
+    }
+
+    ui_screen_t previous = ui_get_screen();
+    stop_requested       = false;
+    playing              = true;
+    ui_set_screen(UI_SCREEN_ANIMATION);
+    power_activity();
+
+    int64_t  start    = esp_timer_get_time();
+    int64_t  end      = start + CONFIG_NOTIFIER_GIF_PLAY_S * 1000000LL;
+    int64_t  deadline = start;
+    int64_t  decoding = 0;
+    uint32_t shown = 0, decoded = 0, late = 0, loops = 0;
+    uint16_t frame = 0;
+
+    while (!stop_requested && esp_timer_get_time() < end && ui_get_screen() == UI_SCREEN_ANIMATION) {
+        uint16_t const* pixels = canvas;
+        uint32_t        delay_ms;
+
+        if (cached && frame == frames) {
+            loops++;
+            if (gif.loop_count != 0 && loops > gif.loop_count) break;
+            frame = 0;
+        }
+
+        gif_cache_entry_t* entry = cached ? cache_find(clip, frame) : NULL;
+        if (entry != NULL) {
+            pixels   = entry->pixels;
+            delay_ms = entry->delay_ms;
+        } else {
+            int64_t      decode_start = esp_timer_get_time();
+            gif_result_t result       = gif_next_frame(&gif, &delay_ms);
+            decoding                 += esp_timer_get_time() - decode_start;
+            if (result == GIF_END && frame > 0) {
+                loops++;
+                if (cacheable) {
+                    cache_set_frames(clip, frame);
+                    frames = frame;
+                    cached = true;
+                }
+                if (gif.loop_count != 0 && loops > gif.loop_count) break;
+                frame = 0;
+                gif_rewind(&gif);
+                continue;
+            }
+            if (result != GIF_FRAME) {
+                ESP_LOGW(TAG, "Decoding %s failed at frame %u", path, frame);
+                break;
+            }
+            decoded++;
+            if (cacheable && !cache_insert(clip, frame, delay_ms, canvas)) {
+                cacheable = false;
+                cache_drop_clip(clip);
+            }
+        }
+
+        wait_until(deadline);
+        if (esp_timer_get_time() > deadline + 1000 * (int64_t)delay_ms) {
+            late++;
+            deadline = esp_timer_get_time();  // Fell behind, don't try to catch up with a burst
+        }
+        if (stop_requested || !present(pixels)) break;
+        deadline += 1000 * (int64_t)delay_ms;
+        shown++;
+        frame++;
+    }
+
+    int64_t elapsed = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "%s: %" PRIu32 " frames in %" PRId64 " ms (%" PRIu32 " decoded, %" PRId64 " ms each, %" PRIu32
+             " late), %s", path, shown, elapsed / 1000, decoded, decoded ? decoding / decoded / 1000 : 0, late,
+             cached ? "cached" : "streamed");
+
+    playing = false;
+    // Unless a key already switched away from the animation
+    ui_replace_screen(UI_SCREEN_ANIMATION, previous);
+    gif_close(&gif);
+    fclose(file);
+    heap_caps_free(canvas);
+}
+
+static void gif_player_task(void* pvParameters) {
+    char path[GIF_PATH_LENGTH];
+    while (1) {
+        if (xQueueReceive(request_queue, path, portMAX_DELAY) == pdTRUE) {
+            play(path);
+        }
+    }
+}
+
+esp_err_t gif_player_init(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation,
+                          bool reversed) {
+    if (format != PAX_BUF_16_565RGB) {
+        ESP_LOGW(TAG, "Animations need a 16 bit display");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    screen_h_res       = h_res;
+    screen_v_res       = v_res;
+    screen_orientation = orientation;
+    screen_reversed    = reversed;
+
+    request_queue  = xQueueCreate(GIF_QUEUE_LENGTH, GIF_PATH_LENGTH);
+    frame_consumed = xSemaphoreCreateBinary();
+    if (request_queue == NULL || frame_consumed == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(gif_player_task, "gif_task", 4096, NULL, 7, &player_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Only queued, the player task opens the file. Requests while a clip plays are dropped.
+void gif_player_play(char const* path) {
+    if (request_queue == NULL || playing) {
+        return;
+    }
+    char request[GIF_PATH_LENGTH];
+    strlcpy(request, path, sizeof(request));
+    xQueueSend(request_queue, request, 0);
+}
+
+// Events play the clip named after their type, "Nyan" plays nyan.gif. Only letters, digits, dashes
+// and underscores are used, so a type can not point outside the directory.
+void gif_player_play_event(char const* type) {
+    char   path[GIF_PATH_LENGTH];
+    size_t length = snprintf(path, sizeof(path), "%s/", CONFIG_NOTIFIER_GIF_DIRECTORY);
+    for (char const* c = type; *c && length < sizeof(path) - 5; c++) {
+        if (isalnum((unsigned char)*c) || *c == '-' || *c == '_') {
+            path[length++] = tolower((unsigned char)*c);
+        }
+    }
+    if (length == strlen(CONFIG_NOTIFIER_GIF_DIRECTORY) + 1) {
+        return;
+    }
+    strcpy(path + length, ".gif");
+    gif_player_play(path);
+}
+
+// Returns true when a clip was playing
+bool gif_player_stop(void) {
+    if (!playing) {
+        return false;
+    }
+    stop_requested = true;
+    xTaskNotifyGive(player_task);
+    return true;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "pax_types.h"
+
+esp_err_t gif_player_init(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation,
+                          bool reversed);
+void      gif_player_play(char const* path);
+void      gif_player_play_event(char const* type);
+bool      gif_player_stop(void);
+void      gif_player_draw(pax_buf_t* fb);
@@ -0,0 +1,235 @@
+#include "glyph_cache.h"
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "pax_gfx.h"
+#include "pax_text.h"
+
+// Glyph atlas: every character of a charset is rendered once into an 8-bit coverage mask, after
+// which text is drawn by blending those masks instead of rasterizing the font again. Frames are
+// drawn into buffers with the panel's raw layout, so for RGB565 targets the masks are blended
+// straight into pixel memory with the orientation folded into the address stepping.
+
+static char const TAG[] = "glyph_cache";
+
+static int               target_h_res       = 0;
+static int               target_v_res       = 0;
+static pax_buf_type_t    target_format      = PAX_BUF_16_565RGB;
+static pax_orientation_t target_orientation = PAX_O_UPRIGHT;
+static bool              target_reversed    = false;
+
+// Describe the raw layout of the buffers glyphs get drawn into
+void glyph_cache_set_target(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation,
+                            bool reversed) {
+    target_h_res       = h_res;
+    target_v_res       = v_res;
+    target_format      = format;
+    target_orientation = orientation;
+    target_reversed    = reversed;
+}
+
+esp_err_t glyph_cache_create(glyph_cache_t* cache, pax_font_t const* font, float size, char const* charset) {
+    memset(cache, 0, sizeof(glyph_cache_t));
+    cache->font = font;
+    cache->size = size;
+
+    pax_vec2f cell = pax_text_size(font, size, "0");
+    cache->glyph_w = (int)(cell.x + 0.5f);
+    cache->glyph_h = (int)(cell.y + 0.5f);
+
+    size_t length = strlen(charset);
+    if (length > 127 || cache->glyph_w <= 0 || cache->glyph_h <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    size_t glyph_size = cache->glyph_w * cache->glyph_h;
+    cache->masks      = heap_caps_malloc(length * glyph_size, MALLOC_CAP_SPIRAM);
+    if (cache->masks == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate atlas for %u glyphs at size %d", (unsigned)length, (int)size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    pax_buf_t scratch = {0};
+    pax_buf_init(&scratch, NULL, cache->glyph_w, cache->glyph_h, PAX_BUF_8_GREY);
+
+    for (size_t i = 0; i < length; i++) {
+        unsigned char character = charset[i];
+        if (character >= 128 || cache->slots[character] != 0) {
+            continue;
+        }
+        char text[2] = {character, '\0'};
+        pax_background(&scratch, 0xFF000000);
+        pax_draw_text(&scratch, 0xFFFFFFFF, font, size, 0, 0, text);
+        memcpy(cache->masks + cache->count * glyph_size, pax_buf_get_pixels(&scratch), glyph_size);
+        cache->slots[character] = ++cache->count;
+    }
+
+    pax_buf_destroy(&scratch);
+    ESP_LOGI(TAG, "Cached %u glyphs of %dx%d px", (unsigned)cache->count, cache->glyph_w, cache->glyph_h);
+    return ESP_OK;
+}
+
+void glyph_cache_destroy(glyph_cache_t* cache) {
+    heap_caps_free(cache->masks);
+    memset(cache, 0, sizeof(glyph_cache_t));
+}
+
+static inline uint16_t blend_565(uint16_t dst, uint32_t r, uint32_t g, uint32_t b, uint32_t alpha) {
+    uint32_t inverse = 255 - alpha;
+    uint32_t dst_r   = (dst >> 11) & 0x1F;
+    uint32_t dst_g   = (dst >> 5) & 0x3F;
+    uint32_t dst_b   = dst & 0x1F;
+    dst_r            = (r * alpha + dst_r * inverse) / 255;
+    dst_g            = (g * alpha + dst_g * inverse) / 255;
+    dst_b            = (b * alpha + dst_b * inverse) / 255;
+    return (dst_r << 11) | (dst_g << 5) | dst_b;
+}
+
+static void draw_glyph_565(pax_buf_t* buf, uint8_t const* mask, int glyph_w, int glyph_h, pax_col_t color, int x0,
+                           int y0, pax_recti const* clip) {
+    // Raw index of oriented pixel (x, y) is base + x * step_x + y * step_y
+    int       w = target_h_res, h = target_v_res;
+    ptrdiff_t base = 0, step_x = 1, step_y = w;
+    switch (target_orientation) {
+        case PAX_O_ROT_CCW:
+            base   = (ptrdiff_t)(h - 1) * w;
+            step_x = -w;
+            step_y = 1;
+            break;
+        case PAX_O_ROT_HALF:
+            base   = (ptrdiff_t)w * h - 1;
+            step_x = -1;
+            step_y = -w;
+            break;
+        case PAX_O_ROT_CW:
+            base   = w - 1;
+            step_x = w;
+            step_y = -1;
+            break;
+        case PAX_O_UPRIGHT:
+        default:
+            break;
+    }
+
+    int gx0 = clip->x > x0 ? clip->x - x0 : 0;
+    int gy0 = clip->y > y0 ? clip->y - y0 : 0;
+    int gx1 = clip->x + clip->w < x0 + glyph_w ? clip->x + clip->w - x0 : glyph_w;
+    int gy1 = clip->y + clip->h < y0 + glyph_h ? clip->y + clip->h - y0 : glyph_h;
+
+    uint32_t  r      = ((color >> 16) & 0xFF) >> 3;
+    uint32_t  g      = ((color >> 8) & 0xFF) >> 2;
+    uint32_t  b      = (color & 0xFF) >> 3;
+    uint32_t  opaque = (r << 11) | (g << 5) | b;
+    uint16_t* pixels = pax_buf_get_pixels_rw(buf);
+
+    for (int gy = gy0; gy < gy1; gy++) {
+        uint8_t const* row   = mask + gy * glyph_w;
+        ptrdiff_t      index = base + (x0 + gx0) * step_x + (y0 + gy) * step_y;
+        for (int gx = gx0; gx < gx1; gx++, index += step_x) {
+            uint8_t alpha = row[gx];
+            if (alpha == 0) {
+                continue;
+            }
+            if (alpha == 255) {
+                pixels[index] = target_reversed ? __builtin_bswap16(opaque) : opaque;
+                continue;
+            }
+            uint16_t dst  = target_reversed ? __builtin_bswap16(pixels[index]) : pixels[index];
+            uint16_t out  = blend_565(dst, r, g, b, alpha);
+            pixels[index] = target_reversed ? __builtin_bswap16(out) : out;
+        }
+    }
+}
+
+static void draw_glyph_generic(pax_buf_t* buf, uint8_t const* mask, int glyph_w, int glyph_h, pax_col_t color,
+                               int x0, int y0, pax_recti const* clip) {
+    for (int gy = 0; gy < glyph_h; gy++) {
+        int y = y0 + gy;
+        if (y < clip->y || y >= clip->y + clip->h) continue;
+        for (int gx = 0; gx < glyph_w; gx++) {
+            int x = x0 + gx;
+            if (x < clip->x || x >= clip->x + clip->w) continue;
+            uint8_t alpha = mask[gy * glyph_w + gx];
+            if (alpha == 0) continue;
+            pax_merge_pixel(buf, (color & 0x00FFFFFF) | ((uint32_t)alpha << 24), x, y);
+        }
+    }
+}
+
+static bool is_cached(glyph_cache_t const* cache, unsigned char character) {
+    return character < 128 && cache->slots[character] != 0;
+}
+
+// Characters outside the atlas, like multi-byte UTF-8 sequences, are handed to PAX as a run so it
+// decodes every sequence as a whole. The cursor moves by the width PAX measures for the run.
+// Returns the length of the run that was drawn.
+static size_t draw_uncached(pax_buf_t* buf, glyph_cache_t const* cache, pax_col_t color, int* cursor_x, int cursor_y,
+                            char const* text) {
+    char   run[64];
+    size_t length = 0;
+    while (text[length] != '\0' && !is_cached(cache, text[length]) && length < sizeof(run) - 1) {
+        length++;
+    }
+    // A run that fills the buffer must not end halfway a sequence, continuation bytes are 10xxxxxx
+    if (text[length] != '\0' && !is_cached(cache, text[length])) {
+        size_t end = length;
+        while (end > 1 && ((unsigned char)text[end] & 0xC0) == 0x80) end--;
+        length = end;
+    }
+    memcpy(run, text, length);
+    run[length] = '\0';
+
+    pax_draw_text(buf, color, cache->font, cache->size, *cursor_x, cursor_y, run);
+    *cursor_x += (int)(pax_text_size(cache->font, cache->size, run).x + 0.5f);
+    return length;
+}
+
+void glyph_cache_draw(pax_buf_t* buf, glyph_cache_t const* cache, pax_col_t color, float x, float y,
+                      char const* text) {
+    if (cache->masks == NULL) {
+        pax_draw_text(buf, color, cache->font, cache->size, x, y, text);
+        return;
+    }
+
+    // Never trust the clip rectangle to be inside the buffer, the fast path writes raw memory
+    bool      rotated = target_orientation == PAX_O_ROT_CCW || target_orientation == PAX_O_ROT_CW;
+    int       width   = rotated ? target_v_res : target_h_res;
+    int       height  = rotated ? target_h_res : target_v_res;
+    pax_recti clip    = pax_get_clip(buf);
+    int       clip_x1 = clip.x + clip.w < width ? clip.x + clip.w : width;
+    int       clip_y1 = clip.y + clip.h < height ? clip.y + clip.h : height;
+
+    clip.x = clip.x > 0 ? clip.x : 0;
+    clip.y = clip.y > 0 ? clip.y : 0;
+    clip.w = clip_x1 - clip.x;
+    clip.h = clip_y1 - clip.y;
+
+    bool   fast       = target_format == PAX_BUF_16_565RGB && (color >> 24) == 0xFF;
+    size_t glyph_size = cache->glyph_w * cache->glyph_h;
+    int    cursor_x   = (int)x;
+    int    cursor_y   = (int)y;
+
+    char const* c = text;
+    while (*c != '\0') {
+        unsigned char character = *c;
+        if (!is_cached(cache, character)) {
+            c += draw_uncached(buf, cache, color, &cursor_x, cursor_y, c);
+            continue;
+        }
+        int glyph_x = cursor_x;
+        c++;
+        cursor_x += cache->glyph_w;
+
+        // Skip glyphs entirely outside the clip rectangle
+        if (glyph_x >= clip.x + clip.w || glyph_x + cache->glyph_w <= clip.x || cursor_y >= clip.y + clip.h ||
+            cursor_y + cache->glyph_h <= clip.y) {
+            continue;
+        }
+        uint8_t const* mask = cache->masks + (cache->slots[character] - 1) * glyph_size;
+        if (fast) {
+            draw_glyph_565(buf, mask, cache->glyph_w, cache->glyph_h, color, glyph_x, cursor_y, &clip);
+        } else {
+            draw_glyph_generic(buf, mask, cache->glyph_w, cache->glyph_h, color, glyph_x, cursor_y, &clip);
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "pax_types.h"
+
+#define GLYPH_CACHE_ASCII_PRINTABLE " !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~"
+
+// Pre-rasterized alpha masks for one (monospace font, size) pair
+typedef struct {
+    pax_font_t const* font;
+    float             size;
+    int               glyph_w;
+    int               glyph_h;
+    size_t            count;
+    uint8_t           slots[128];  // Character code to slot + 1, 0 when the character is not cached
+    uint8_t*          masks;       // count * glyph_w * glyph_h coverage values
+} glyph_cache_t;
+
+void      glyph_cache_set_target(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation,
+                                 bool reversed);
+esp_err_t glyph_cache_create(glyph_cache_t* cache, pax_font_t const* font, float size, char const* charset);
+void      glyph_cache_destroy(glyph_cache_t* cache);
+void      glyph_cache_draw(pax_buf_t* buf, glyph_cache_t const* cache, pax_col_t color, float x, float y,
+                           char const* text);
@@ -0,0 +1,195 @@
+#include "latency.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+
+// End-to-end notification latency, from the send timestamp in an event to the first frame that is
+// handed to the panel after the event arrived. Sender and receiver clocks are both set from
+// RTC/SNTP, the same wall-clock time the clock screen shows. Latencies go into a histogram per
+// sender and one over all senders; gaps in a sender's sequence numbers are counted as lost.
+
+#define LATENCY_FINE_MS       10    // Bucket width up to LATENCY_FINE_LIMIT_MS
+#define LATENCY_FINE_LIMIT_MS 2000
+#define LATENCY_COARSE_MS     1000  // Bucket width above that, up to LATENCY_LIMIT_MS
+#define LATENCY_LIMIT_MS      60000
+#define LATENCY_BUCKETS \
+    (LATENCY_FINE_LIMIT_MS / LATENCY_FINE_MS + (LATENCY_LIMIT_MS - LATENCY_FINE_LIMIT_MS) / LATENCY_COARSE_MS + 1)
+#define LATENCY_PENDING       8
+#define LATENCY_SECONDS_LIMIT 100000000000LL  // Timestamps below this are in seconds
+
+typedef struct {
+    uint16_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+} latency_histogram_t;
+
+typedef struct {
+    char                sender[LATENCY_SENDER_LENGTH];
+    uint32_t            received;
+    uint32_t            lost;
+    uint32_t            last_sequence;
+    latency_histogram_t histogram;
+} latency_sender_t;
+
+typedef struct {
+    int64_t sent_ms;
+    uint8_t sender;  // Index into senders, or LATENCY_MAX_SENDERS for the totals only
+} latency_pending_t;
+
+static portMUX_TYPE        latency_lock                 = portMUX_INITIALIZER_UNLOCKED;
+static latency_sender_t    senders[LATENCY_MAX_SENDERS] = {0};
+static size_t              sender_count                 = 0;
+static latency_histogram_t total                        = {0};
+static latency_pending_t   pending[LATENCY_PENDING]     = {0};
+static size_t              pending_count                = 0;
+static size_t              pending_in_frame             = 0;  // Arrived before the current frame started
+static uint32_t            version                      = 0;
+
+// Copy taken by latency_get_stats, so the percentiles are computed outside the critical section
+static latency_sender_t    snapshot_senders[LATENCY_MAX_SENDERS];
+static latency_histogram_t snapshot_total;
+
+int64_t latency_now_ms(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+static size_t bucket_for(int64_t ms) {
+    if (ms < 0) ms = 0;
+    if (ms < LATENCY_FINE_LIMIT_MS) return ms / LATENCY_FINE_MS;
+    if (ms < LATENCY_LIMIT_MS) {
+        return LATENCY_FINE_LIMIT_MS / LATENCY_FINE_MS + (ms - LATENCY_FINE_LIMIT_MS) / LATENCY_COARSE_MS;
+    }
+    return LATENCY_BUCKETS - 1;
+}
+
+// Upper bound of a bucket, LATENCY_LIMIT_MS stands for anything longer
+static uint32_t bucket_limit(size_t bucket) {
+    size_t fine = LATENCY_FINE_LIMIT_MS / LATENCY_FINE_MS;
+    if (bucket < fine) return (bucket + 1) * LATENCY_FINE_MS;
+    return LATENCY_FINE_LIMIT_MS + (bucket - fine + 1) * LATENCY_COARSE_MS;
+}
+
+static void histogram_add(latency_histogram_t* histogram, size_t bucket) {
+    if (histogram->buckets[bucket] == UINT16_MAX) {
+        // Halve everything rather than saturate, the distribution stays the same
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            histogram->buckets[i] /= 2;
+        }
+        histogram->count = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            histogram->count += histogram->buckets[i];
+        }
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+}
+
+static uint32_t histogram_percentile(latency_histogram_t const* histogram, uint32_t percent) {
+    if (histogram->count == 0) return 0;
+    uint32_t target = (histogram->count * percent + 99) / 100;
+    uint32_t seen   = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target) return bucket_limit(i);
+    }
+    return LATENCY_LIMIT_MS;
+}
+
+static size_t find_sender(char const* sender) {
+    for (size_t i = 0; i < sender_count; i++) {
+        if (strcmp(senders[i].sender, sender) == 0) return i;
+    }
+    if (sender_count < LATENCY_MAX_SENDERS) {
+        latency_sender_t* entry = &senders[sender_count];
+        memset(entry, 0, sizeof(*entry));
+        snprintf(entry->sender, sizeof(entry->sender), "%s", sender);
+        return sender_count++;
+    }
+    return LATENCY_MAX_SENDERS;
+}
+
+// Called by the MQTT task for every event that carries tracing information
+void latency_received(char const* sender, uint32_t sequence, int64_t sent_ms) {
+    if (sent_ms < LATENCY_SECONDS_LIMIT) sent_ms *= 1000;
+
+    taskENTER_CRITICAL(&latency_lock);
+    size_t index = find_sender(sender);
+    if (index < LATENCY_MAX_SENDERS) {
+        latency_sender_t* entry = &senders[index];
+        if (entry->received > 0 && sequence > entry->last_sequence) {
+            entry->lost += sequence - entry->last_sequence - 1;
+        }
+        // A lower sequence number means the sender restarted, duplicates are counted again
+        entry->last_sequence = sequence;
+        entry->received++;
+    }
+    if (pending_count < LATENCY_PENDING) {
+        pending[pending_count++] = (latency_pending_t){sent_ms, index};
+    }
+    version++;
+    taskEXIT_CRITICAL(&latency_lock);
+}
+
+// Called by the render task before it starts drawing a frame, events that arrive later are not in it
+void latency_frame_begin(void) {
+    taskENTER_CRITICAL(&latency_lock);
+    pending_in_frame = pending_count;
+    taskEXIT_CRITICAL(&latency_lock);
+}
+
+// Called by the render task once the frame has been handed to the panel
+void latency_frame_presented(void) {
+    if (pending_in_frame == 0) return;
+
+    int64_t now = latency_now_ms();
+    taskENTER_CRITICAL(&latency_lock);
+    for (size_t i = 0; i < pending_in_frame; i++) {
+        size_t bucket = bucket_for(now - pending[i].sent_ms);
+        histogram_add(&total, bucket);
+        if (pending[i].sender < LATENCY_MAX_SENDERS) {
+            histogram_add(&senders[pending[i].sender].histogram, bucket);
+        }
+    }
+    pending_count -= pending_in_frame;
+    memmove(pending, pending + pending_in_frame, pending_count * sizeof(latency_pending_t));
+    pending_in_frame = 0;
+    version++;
+    taskEXIT_CRITICAL(&latency_lock);
+}
+
+static void fill_stats(latency_stats_t* out, latency_histogram_t const* histogram) {
+    out->p50_ms = histogram_percentile(histogram, 50);
+    out->p95_ms = histogram_percentile(histogram, 95);
+    out->p99_ms = histogram_percentile(histogram, 99);
+}
+
+// Copies the current numbers, returns the number of senders written. Only call from one task.
+size_t latency_get_stats(latency_stats_t* total_out, latency_stats_t* senders_out, size_t max) {
+    taskENTER_CRITICAL(&latency_lock);
+    size_t count = sender_count;
+    memcpy(snapshot_senders, senders, count * sizeof(latency_sender_t));
+    snapshot_total = total;
+    taskEXIT_CRITICAL(&latency_lock);
+
+    memset(total_out, 0, sizeof(*total_out));
+    for (size_t i = 0; i < count; i++) {
+        total_out->received += snapshot_senders[i].received;
+        total_out->lost     += snapshot_senders[i].lost;
+        if (i < max) {
+            latency_stats_t* out = &senders_out[i];
+            snprintf(out->sender, sizeof(out->sender), "%s", snapshot_senders[i].sender);
+            out->received = snapshot_senders[i].received;
+            out->lost     = snapshot_senders[i].lost;
+            fill_stats(out, &snapshot_senders[i].histogram);
+        }
+    }
+    fill_stats(total_out, &snapshot_total);
+    return count < max ? count : max;
+}
+
+// Changes whenever the statistics change, so the diagnostics screen only redraws when needed
+uint32_t latency_version(void) {
+    return version;
+}
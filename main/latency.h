@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LATENCY_MAX_SENDERS   6
+#define LATENCY_SENDER_LENGTH 32
+
+typedef struct {
+    char     sender[LATENCY_SENDER_LENGTH];  // Empty for the totals over all senders
+    uint32_t received;
+    uint32_t lost;  // Sequence numbers skipped
+    uint32_t p50_ms;
+    uint32_t p95_ms;
+    uint32_t p99_ms;
+} latency_stats_t;
+
+int64_t  latency_now_ms(void);
+void     latency_received(char const* sender, uint32_t sequence, int64_t sent_ms);
+void     latency_frame_begin(void);
+void     latency_frame_presented(void);
+size_t   latency_get_stats(latency_stats_t* total, latency_stats_t* senders, size_t max);
+uint32_t latency_version(void);
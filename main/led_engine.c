@@ -0,0 +1,153 @@
+#include "led_engine.h"
+#include <math.h>
+#include <string.h>
+#include "bsp/led.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+// Drives the six status LEDs. Every LED is bound to a state source; whoever owns the state sets the
+// animation of the source whenever it changes, and the engine task renders all LEDs from lookup
+// tables at a fixed tick. The LED bus is only written when the output bytes actually change, and
+// when nothing animates the task sleeps until the next change.
+
+#define LED_LUT_SIZE 64
+
+typedef struct {
+    led_animation_t animation;
+    int64_t         start_ms;
+    bool            active;
+} led_source_state_t;
+
+static char const TAG[] = "led_engine";
+
+static uint8_t            curves[LED_CURVE_COUNT][LED_LUT_SIZE];
+static led_source_state_t sources[LED_SOURCE_COUNT] = {0};
+static led_source_t       bindings[LED_ENGINE_LEDS] = {0};
+static portMUX_TYPE       led_lock                  = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t       led_task_handle           = NULL;
+static uint8_t            written[LED_ENGINE_LEDS * 3];  // What the LEDs currently show
+static bool               written_valid = false;
+
+static void build_curves(void) {
+    for (size_t i = 0; i < LED_LUT_SIZE; i++) {
+        float phase = (float)i / LED_LUT_SIZE;
+        // Squared, which looks closer to linear to the eye than the raw raised cosine and ramp
+        float pulse = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * phase);
+        float fade  = 1.0f - phase;
+
+        curves[LED_CURVE_SOLID][i] = 255;
+        curves[LED_CURVE_BLINK][i] = i < LED_LUT_SIZE / 2 ? 255 : 0;
+        curves[LED_CURVE_PULSE][i] = (uint8_t)(pulse * pulse * 255.0f + 0.5f);
+        curves[LED_CURVE_FADE][i]  = (uint8_t)(fade * fade * 255.0f + 0.5f);
+    }
+}
+
+static uint8_t scale(uint32_t color, int shift, uint8_t level) {
+    return (((color >> shift) & 0xFF) * level + 127) / 255;
+}
+
+// Renders one frame into out, returns whether any LED is still animating
+static bool render(uint8_t* out, int64_t now_ms) {
+    led_source_state_t snapshot[LED_SOURCE_COUNT];
+    taskENTER_CRITICAL(&led_lock);
+    memcpy(snapshot, sources, sizeof(snapshot));
+    taskEXIT_CRITICAL(&led_lock);
+
+    bool animating = false;
+    for (size_t led = 0; led < LED_ENGINE_LEDS; led++) {
+        led_source_state_t const* source = &snapshot[bindings[led]];
+        led_animation_t const*    anim   = &source->animation;
+        int64_t                   age_ms = now_ms - source->start_ms;
+        uint8_t                   level  = 0;
+
+        if (source->active && (anim->duration_ms == 0 || age_ms < anim->duration_ms)) {
+            if (anim->curve == LED_CURVE_SOLID || anim->period_ms == 0) {
+                level = 255;
+            } else if (anim->curve == LED_CURVE_FADE && age_ms >= anim->period_ms) {
+                level = 0;  // Faded out, nothing left to animate unless a duration runs out
+            } else {
+                level     = curves[anim->curve][(age_ms % anim->period_ms) * LED_LUT_SIZE / anim->period_ms];
+                animating = true;
+            }
+            animating |= anim->duration_ms != 0;
+        }
+
+        // The LED bus takes GRB
+        out[led * 3 + 0] = scale(anim->color, 8, level);
+        out[led * 3 + 1] = scale(anim->color, 16, level);
+        out[led * 3 + 2] = scale(anim->color, 0, level);
+    }
+    return animating;
+}
+
+static void led_task(void* pvParameters) {
+    uint8_t frame[LED_ENGINE_LEDS * 3];
+    while (1) {
+        bool animating = render(frame, esp_timer_get_time() / 1000);
+
+        if (!written_valid || memcmp(frame, written, sizeof(frame)) != 0) {
+            if (bsp_led_write(frame, sizeof(frame)) == ESP_OK) {
+                memcpy(written, frame, sizeof(written));
+                written_valid = true;
+            }
+        }
+
+        // Tick while something moves, otherwise sleep until a source changes
+        ulTaskNotifyTake(pdTRUE, animating || !written_valid ? pdMS_TO_TICKS(CONFIG_NOTIFIER_LED_TICK_MS)
+                                                             : portMAX_DELAY);
+    }
+}
+
+esp_err_t led_engine_init(void) {
+    build_curves();
+    esp_err_t res = bsp_led_initialize();
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize LEDs: %s", esp_err_to_name(res));
+        return res;
+    }
+    if (xTaskCreate(led_task, "led_task", 3072, NULL, 5, &led_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void led_engine_bind(size_t led, led_source_t source) {
+    if (led >= LED_ENGINE_LEDS || source >= LED_SOURCE_COUNT) {
+        return;
+    }
+    bindings[led] = source;
+    if (led_task_handle != NULL) {
+        xTaskNotifyGive(led_task_handle);
+    }
+}
+
+// Starts the animation of a source from its first frame, NULL turns the source off. Setting the
+// running endless animation again keeps its phase, so level states can be set on every poll. Safe
+// to call from any task.
+void led_engine_set(led_source_t source, led_animation_t const* animation) {
+    if (source == LED_SOURCE_NONE || source >= LED_SOURCE_COUNT) {
+        return;
+    }
+
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    taskENTER_CRITICAL(&led_lock);
+    led_source_state_t* state = &sources[source];
+    if (animation != NULL && animation->duration_ms == 0 && state->active &&
+        memcmp(&state->animation, animation, sizeof(*animation)) == 0) {
+        taskEXIT_CRITICAL(&led_lock);
+        return;
+    }
+    sources[source].active   = animation != NULL;
+    sources[source].start_ms = now_ms;
+    if (animation != NULL) {
+        sources[source].animation = *animation;
+    }
+    taskEXIT_CRITICAL(&led_lock);
+
+    if (led_task_handle != NULL) {
+        xTaskNotifyGive(led_task_handle);
+    }
+}
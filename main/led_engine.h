@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define LED_ENGINE_LEDS 6
+
+typedef enum {
+    LED_CURVE_SOLID,  // Constant color
+    LED_CURVE_BLINK,  // On for the first half of every period
+    LED_CURVE_PULSE,  // Smoothly breathes in and out once per period
+    LED_CURVE_FADE,   // Fades out once over the period, then stays off
+    LED_CURVE_COUNT,
+} led_curve_t;
+
+// State sources the LEDs can be bound to
+typedef enum {
+    LED_SOURCE_NONE,
+    LED_SOURCE_BATTERY,
+    LED_SOURCE_WIFI,
+    LED_SOURCE_MESSAGE,
+    LED_SOURCE_TRANSMIT,
+    LED_SOURCE_COUNT,
+} led_source_t;
+
+typedef struct {
+    uint32_t    color;        // 0xRRGGBB at full brightness
+    led_curve_t curve;
+    uint16_t    period_ms;    // Length of one animation cycle, ignored for solid
+    uint16_t    duration_ms;  // The source turns off after this long, 0 to keep going
+} led_animation_t;
+
+esp_err_t led_engine_init(void);
+void      led_engine_bind(size_t led, led_source_t source);
+void      led_engine_set(led_source_t source, led_animation_t const* animation);
@@ -15,21 +15,43 @@
 #include "esp_lcd_types.h"
 
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "event_json.h"
 #include "hal/lcd_types.h"
 #include "hal/uart_types.h"
 #include "nvs_flash.h"
-#include "pax_fonts.h"
 #include "pax_gfx.h"
-#include "pax_text.h"
-#include "pax_codecs.h"
 #include "portmacro.h"
 
+#include "app_state.h"
+#include "boot_time.h"
+#include "led_engine.h"
+#include "connection_manager.h"
+#include "gif_player.h"
+#include "message_crypto.h"
+#include "message_log.h"
+#include "message_ring.h"
+#include "message_rx.h"
+#include "outbox.h"
+#include "panel.h"
+#include "perf.h"
+#include "power.h"
+#include "render_scheduler.h"
+#include "rx_filter.h"
+#include "sd_bench.h"
 #include "sdcard.h"
+#include "settings.h"
+#include "topic_router.h"
+#include "ui.h"
 
 #include "wifi_connection.h"
 #include "wifi_remote.h"
 
+#include "esp_crt_bundle.h"
 #include "mqtt_client.h"
+#include "mqtt_tls.h"
 #include "esp_netif.h"
 #include "esp_sntp.h"
 
@@ -40,12 +62,10 @@
 // Constants
 static char const TAG[] = "main";
 
-#define MQTT_BROKER_URI "mqtt://broker.hivemq.com"
 
 #define LED_GREEN 0x03FC03
 #define LED_YELLOW 0xF4FC03
 #define LED_RED 0xFC0303
-#define LED_OFF 0x0
 #define LED_BLUE 0x0303FC
 
 // Global variables
@@ -53,294 +73,304 @@ static size_t                       display_h_res        = 0;
 static size_t                       display_v_res        = 0;
 static lcd_color_rgb_pixel_format_t display_color_format = LCD_COLOR_PIXEL_FORMAT_RGB565;
 static lcd_rgb_data_endian_t        display_data_endian  = LCD_RGB_DATA_ENDIAN_LITTLE;
-static pax_buf_t                    fb                   = {0};
 
 static esp_lcd_panel_handle_t    lcd_panel         = NULL;
 static QueueHandle_t                input_event_queue    = NULL;
-SemaphoreHandle_t line_mutex;
-esp_mqtt_client_handle_t client = NULL;
-bsp_power_battery_information_t battery_info;
+// Only the connection manager task creates and uses the client, the event handler gets its own
+static esp_mqtt_client_handle_t client = NULL;
 
 extern uint8_t const wallpaper_start[] asm("_binary_wallpaper_png_start");
 extern uint8_t const wallpaper_end[] asm("_binary_wallpaper_png_end");
 
-bool inactive_show_time = false;
-
-#define num_chars 60
-
-char line_buffer[num_chars] = {0};
-uint8_t led_buffer[6 * 3] = {0};
-
-time_t now_time;
-struct tm timeinfo;
-
-uint8_t msg_led_cnt = 0;
-bool mqtt_initialized = false;
-bool mqtt_msg_event = false;
-bool mqtt_msg_transmit = false;
-bool wifi_connected = false;
-bool wifi_connecting = false;
-bool sd_card_present = false;
-
-
-#define HEADER_HEIGHT  30
-#define FOOTER_HEIGHT  30
-#define BUTTON_WIDTH   100
-#define BUTTON_HEIGHT  100
-#define BUTTON_GAP     20
-#define TEXT_FIELD_HEIGTH  24
-
-
-const char* menu_title = "Event Notifier";
-const char* connection_status = "Wi-Fi: Connected";
-const char* footer_text = "Use left/right to navigate. Press return to select.";
-const char* buttons[] = {"Nyan", "Coffee", "Lunch"};
-#define NUM_BUTTONS 3
-
-
-void init(void) {
-    line_mutex = xSemaphoreCreateMutex();
-}
-
-void add_line(char* text) {
-    if (xSemaphoreTake(line_mutex, portMAX_DELAY)) {
-
-        size_t len = strnlen(text, num_chars - 1);
-        for (size_t i = 0; i < len; i++) {
-            if (text[i] == '\r' || text[i] == '\n') {
-                text[i] = ' ';
+// What the status LEDs show for every state
+static led_animation_t const led_battery_charging = {LED_GREEN, LED_CURVE_SOLID, 0, 0};
+static led_animation_t const led_battery_ok       = {LED_BLUE, LED_CURVE_SOLID, 0, 0};
+static led_animation_t const led_battery_low      = {LED_YELLOW, LED_CURVE_SOLID, 0, 0};
+static led_animation_t const led_battery_critical = {LED_RED, LED_CURVE_PULSE, 2000, 0};
+static led_animation_t const led_wifi_connected   = {LED_GREEN, LED_CURVE_SOLID, 0, 0};
+static led_animation_t const led_wifi_connecting  = {LED_YELLOW, LED_CURVE_PULSE, 1500, 0};
+static led_animation_t const led_wifi_down        = {LED_RED, LED_CURVE_SOLID, 0, 0};
+static led_animation_t const led_message          = {LED_YELLOW, LED_CURVE_BLINK, 1000, 5000};
+static led_animation_t const led_transmit         = {LED_BLUE, LED_CURVE_FADE, 1000, 1000};
+
+static TaskHandle_t battery_task_handle = NULL;
+
+static void battery_task(void* pvParameters) {
+    bsp_power_battery_information_t battery_info;
+    while (1) {
+        if (bsp_power_get_battery_information(&battery_info) == ESP_OK) {
+            if (battery_info.power_supply_available) {
+                led_engine_set(LED_SOURCE_BATTERY, &led_battery_charging);
+            } else if (battery_info.remaining_percentage < 15.0) {
+                led_engine_set(LED_SOURCE_BATTERY, &led_battery_critical);
+            } else if (battery_info.remaining_percentage < 50.0) {
+                led_engine_set(LED_SOURCE_BATTERY, &led_battery_low);
+            } else {
+                led_engine_set(LED_SOURCE_BATTERY, &led_battery_ok);
             }
         }
-        text[len] = '\0';
 
-
-        // for (size_t i = 0; i < num_lines; i++) {
-        //     line_index[i] = (line_index[i] + 1) % num_lines;
-        // }
-        strncpy(line_buffer, text, num_chars);
-        xSemaphoreGive(line_mutex);
+        // The battery level changes slowly, poll it only as often as the power mode asks for. Woken
+        // early when the mode changes.
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(power_battery_interval_ms()));
     }
 }
 
-void set_led_color(uint8_t led, uint32_t color) {
-    led_buffer[led * 3 + 0] = (color >> 8) & 0xFF;  // G
-    led_buffer[led * 3 + 1] = (color >> 16) & 0xFF; // R
-    led_buffer[led * 3 + 2] = (color >> 0) & 0xFF;  // B
+static void power_mode_changed(power_mode_t mode) {
+    if (battery_task_handle != NULL) {
+        xTaskNotifyGive(battery_task_handle);
+    }
 }
 
-static void led_task(void* pvParameters) {
-    while (1) {
-        esp_err_t res = bsp_power_get_battery_information(&battery_info);
-        if(res == ESP_OK) {
-            if(battery_info.power_supply_available) {
-                set_led_color(0, LED_GREEN);
-            } else if(battery_info.remaining_percentage < 50.0) {
-                set_led_color(0, LED_YELLOW);
-            } else if(battery_info.remaining_percentage < 15.0) {
-                set_led_color(0, LED_RED);
-            } else {
-                set_led_color(0, LED_BLUE); 
-            }
-        } 
-
-
-        if(wifi_connected) set_led_color(1, LED_GREEN); // wifi led
-        else if(wifi_connecting) set_led_color(1, LED_YELLOW);
-        else set_led_color(1, LED_RED);
-
-        if(mqtt_msg_event) {
-            if(msg_led_cnt % 2 == 0) {
-                set_led_color(2, LED_YELLOW); // message led
-            } else {
-                set_led_color(2, LED_OFF); // message led
-                
-            }
-            if(msg_led_cnt >= 10)
-            {
-                msg_led_cnt = 0;
-                mqtt_msg_event = false;
-            }
-            msg_led_cnt++;
-        } else {
-            set_led_color(2, LED_OFF);
-        }
-
-        if(mqtt_msg_transmit) {
-            set_led_color(4, LED_BLUE); // A led
-            mqtt_msg_transmit = false;
-        } else {
-            set_led_color(4, LED_OFF); // A led
-        }
-        // set_led_color(4, LED_OFF); // A led 0x0303FC
-        set_led_color(5, LED_OFF); // B led 0x03FC03
-    
-        bsp_led_write(led_buffer, sizeof(led_buffer));
-        vTaskDelay(pdMS_TO_TICKS(500)); // Delay 1 second
+static void outbox_status_changed(outbox_status_t status, char const* payload) {
+    switch (status) {
+        case OUTBOX_STATUS_QUEUED:
+            ui_set_publish_status("Queued");
+            break;
+        case OUTBOX_STATUS_STORED:
+            ui_set_publish_status("Stored offline");
+            break;
+        case OUTBOX_STATUS_COALESCED:
+            ui_set_publish_status("Already sent");
+            break;
+        case OUTBOX_STATUS_SENT:
+            ui_set_publish_status("Sending");
+            break;
+        case OUTBOX_STATUS_DELIVERED:
+            ui_set_publish_status("Delivered");
+            led_engine_set(LED_SOURCE_TRANSMIT, &led_transmit);
+            break;
+        case OUTBOX_STATUS_FAILED:
+        default:
+            ui_set_publish_status("Not sent");
+            break;
     }
 }
 
-static void mqtt_publish_task(void* pvParameters) {
-    char* text = (char*)pvParameters;
-    if(client) esp_mqtt_client_publish(client, "/esp32/coffee", text, 0, 1, 0);
-    mqtt_msg_transmit = true;
-    vTaskDelete(NULL);
-}
+// Sender ID put in published events, derived from the MAC address at boot
+static char device_id[EVENT_JSON_SENDER_LENGTH] = "tanmatsu";
+
+// Publish an event in the JSON format the other badges parse, the outbox adds sequence number and time
+static void post_event(char const* type, char const* message) {
+    event_json_event_t event = {.fields = EVENT_JSON_FIELD_TYPE | EVENT_JSON_FIELD_SENDER};
+    strlcpy(event.type, type, sizeof(event.type));
+    strlcpy(event.sender, device_id, sizeof(event.sender));
+    if (message != NULL) {
+        strlcpy(event.message, message, sizeof(event.message));
+        event.fields |= EVENT_JSON_FIELD_MESSAGE;
+    }
 
-int selected_button = 0;
+    char payload[OUTBOX_PAYLOAD_LENGTH];
+    if (event_json_format(payload, sizeof(payload), &event) < sizeof(payload)) {
+        outbox_post(settings_get()->topic, payload);
+    }
+}
 
-// Example callback handlers
-void nyanButton_Action() {
-    printf("Button 1 pressed!\n");
-    if(client) esp_mqtt_client_publish(client, "/esp32/coffee", "Event: Nyan", 0, 1, 0);
-    // xTaskCreate(mqtt_publish_task, "mqtt_publish_task", 4096, "Event: Nyan", 1, NULL);
+// The buttons post an event of the type on their label
+static void button_pressed(int index) {
+    settings_t const* current = settings_get();
+    if (index >= 0 && index < current->button_count) {
+        ESP_LOGI(TAG, "Button %d pressed", index + 1);
+        post_event(current->buttons[index], NULL);
+    }
 }
 
-void coffeeButton_Action() {
-    printf("Button 2 pressed!\n");
-    if(client) esp_mqtt_client_publish(client, "/esp32/coffee", "Event: Coffee", 0, 1, 0);
-    // xTaskCreate(mqtt_publish_task, "mqtt_publish_task", 4096, "Event: Coffee", 1, NULL);
+// Recent messages come from RAM, older ones from the log on the SD card: the logged messages that
+// came before the oldest one still in RAM. Not every message makes it to the card, so the log
+// looks that one up by its sequence number.
+static uint32_t history_count(void) {
+    uint32_t pushed = message_ring_count();
+    uint32_t in_ram = pushed < MESSAGE_RING_CAPACITY ? pushed : MESSAGE_RING_CAPACITY;
+    return in_ram + message_log_find(pushed - in_ram);
 }
 
-void lunchButton_Action() {
-    printf("Button 3 pressed!\n");
-    if(client) esp_mqtt_client_publish(client, "/esp32/coffee", "Event: Lunch", 0, 1, 0);
-    // xTaskCreate(mqtt_publish_task, "mqtt_publish_task", 4096, "Event: Lunch", 1, NULL);
+static bool history_get(uint32_t age, message_t* out) {
+    uint32_t pushed = message_ring_count();
+    uint32_t in_ram = pushed < MESSAGE_RING_CAPACITY ? pushed : MESSAGE_RING_CAPACITY;
+    if (age < in_ram) {
+        return message_ring_get(age, out);
+    }
+    uint32_t older = message_log_find(pushed - in_ram);
+    age           -= in_ram;
+    return age < older && message_log_read(older - 1 - age, out);
 }
 
-// Hook button callbacks
-void (*button_callbacks[])() = {
-    nyanButton_Action,
-    coffeeButton_Action,
-    lunchButton_Action
-};
-
-// Drawing functions
-void draw_header(pax_buf_t *buf) {
-    // pax_draw_rect(buf, pax_col_rgb(50, 50, 200), 0, 0, display_v_res, HEADER_HEIGHT);
-
-    //	pax_buf_t *buf, pax_col_t color, float x0, y0, x1, y1
-    pax_draw_line(buf, 0xFF2B2C3A, 10, HEADER_HEIGHT, display_v_res - 20, HEADER_HEIGHT);
-    pax_draw_text(buf, 0xFF2B2C3A, pax_font_sky_mono, 18, 5, 5, menu_title);
-    pax_draw_text(buf, 0xFF2B2C3A, pax_font_sky_mono, 18, display_h_res - 35, 5, connection_status);
+// Events with a clip named after their type on the card play it, "Nyan" plays nyan.gif
+static void event_received(event_json_event_t const* event) {
+    app_state_t state;
+    app_state_read(&state);
+    if (state.sd_card_present && event->type[0] != '\0') {
+        gif_player_play_event(event->type);
+    }
 }
 
-void draw_footer(pax_buf_t *buf) {
-    pax_draw_line(buf, 0xFF2B2C3A, 10, display_h_res - FOOTER_HEIGHT, display_v_res - 20, display_h_res - FOOTER_HEIGHT);
+// With a group key set, messages arrive encrypted. They are collected whole, authenticated and
+// decrypted, and only then handed to the receive path.
+#define RX_SEALED_MAX 512
 
-    // pax_draw_rect(buf, pax_col_rgb(30, 30, 200), 0, display_h_res - FOOTER_HEIGHT, display_v_res, FOOTER_HEIGHT);
-    pax_draw_text(buf, 0xFFFFFFFF, pax_font_sky_mono, 16, 5, display_v_res - FOOTER_HEIGHT, footer_text);
-}
+static uint8_t rx_sealed[RX_SEALED_MAX];
+static uint8_t rx_opened[RX_SEALED_MAX];
+static char    rx_sealed_topic[SETTINGS_TOPIC_LENGTH];
+static size_t  rx_sealed_topic_length = 0;
 
-void draw_buttons(pax_buf_t *buf) {
-    float start_x = (display_h_res - (NUM_BUTTONS * BUTTON_WIDTH + (NUM_BUTTONS - 1) * BUTTON_GAP)) / 2;
-    float y = HEADER_HEIGHT + 40;
+// Handlers of the routes that match the topic of the message being received
+static uint8_t rx_handlers = 0;
 
-    for (int i = 0; i < NUM_BUTTONS; i++) {
-        // pax_col_t color = (i == selected_button) ? pax_col_rgb(255, 255, 0) : pax_col_rgb(100, 100, 100);
-        pax_col_t color = pax_col_rgb(100, 100, 100);
-        pax_col_t highlight_color = pax_col_rgb(150, 150, 150);
-        float x = start_x + i * (BUTTON_WIDTH + BUTTON_GAP);
-        pax_outline_rect(buf, color, x, y, BUTTON_WIDTH, BUTTON_HEIGHT);
-        if((i == selected_button))
-            pax_draw_rect(buf, highlight_color, x, y, BUTTON_WIDTH, BUTTON_HEIGHT);
-        pax_draw_text(buf, 0xFF000000, pax_font_sky_mono, 16, x + 10, y + 42, buttons[i]);
+static bool receive_sealed(esp_mqtt_event_handle_t event) {
+    if (event->current_data_offset == 0) {
+        size_t topic_length    = event->topic_len;
+        rx_sealed_topic_length = topic_length < sizeof(rx_sealed_topic) ? topic_length : sizeof(rx_sealed_topic);
+        memcpy(rx_sealed_topic, event->topic, rx_sealed_topic_length);
+    }
+    if (event->total_data_len > sizeof(rx_sealed)) {
+        return false;  // Larger than anything a badge sends
+    }
+    memcpy(rx_sealed + event->current_data_offset, event->data, event->data_len);
+    if (event->current_data_offset + event->data_len < event->total_data_len) {
+        return false;  // More fragments to come
     }
-}
 
-void draw_text_field(pax_buf_t *buf){
-    uint16_t offset_y = display_h_res - FOOTER_HEIGHT - TEXT_FIELD_HEIGTH;
-    if (xSemaphoreTake(line_mutex, portMAX_DELAY)) {
-    // pax_draw_rect(buf, 0xFF2B2C3A, 0, offset_y, display_v_res, TEXT_FIELD_HEIGTH);
-    pax_draw_text(buf, 0xFF2B2C3A, pax_font_sky_mono, 18, 5, offset_y, line_buffer);
-    // for (int line = 0; line < num_lines; line++) {
-    //     if (line_index[line] >= 0) {
-    //         // printf("%d: %d = %s\r\n", line, line_index[line], line_buffers[line_index[line]]);
-    //     } else {
-    //         // printf("%d: (empty)\r\n", line);
-    //     }
-    // }
-    xSemaphoreGive(line_mutex);
+    size_t    length = 0;
+    esp_err_t res    = message_crypto_open(rx_sealed_topic, rx_sealed_topic_length, rx_sealed, event->total_data_len,
+                                           rx_opened, sizeof(rx_opened), &length);
+#ifdef CONFIG_NOTIFIER_CRYPTO_ACCEPT_PLAIN
+    if (res == ESP_ERR_NOT_SUPPORTED) {
+        memcpy(rx_opened, rx_sealed, event->total_data_len);
+        length = event->total_data_len;
+        res    = ESP_OK;
+    }
+#endif
+    if (res != ESP_OK) {
+        ESP_LOGW(TAG, "Dropped a message on %.*s: %s", (int)rx_sealed_topic_length, rx_sealed_topic,
+                 res == ESP_ERR_NOT_SUPPORTED ? "not encrypted"
+                 : res == ESP_ERR_INVALID_STATE ? "replayed"
+                                                : "failed authentication");
+        return false;
     }
+
+    message_rx_begin(rx_sealed_topic, rx_sealed_topic_length, rx_handlers);
+    message_rx_feed((char const*)rx_opened, length);
+    return message_rx_end();
 }
 
-void selectNextButton(bool indexRight)
-{
-    if(indexRight)
-    {
-        selected_button++;
+static void handle_mqtt_data(esp_mqtt_event_handle_t event) {
+    // Only the first fragment carries the topic
+    if (event->current_data_offset == 0) {
+        rx_handlers = topic_router_match(event->topic, event->topic_len);
+    }
+    if (rx_handlers == 0) {
+        return;  // No route for it, e.g. a filter the persistent session still has from older settings
+    }
 
+    if (message_crypto_enabled()) {
+        if (!receive_sealed(event)) {
+            return;
+        }
     } else {
-        selected_button--;
+        if (event->current_data_offset == 0) {
+            message_rx_begin(event->topic, event->topic_len, rx_handlers);
+        }
+        message_rx_feed(event->data, event->data_len);
+        if (event->current_data_offset + event->data_len < event->total_data_len) {
+            return;  // More fragments to come
+        }
+        if (!message_rx_end()) {
+            return;
+        }
     }
 
-    if(selected_button > 2) selected_button = 0;
-    else if (selected_button < 0) selected_button = 2;
-}
-
-void render_gui() {
-    pax_background(&fb, pax_col_rgb(220, 220, 220));
-    draw_header(&fb);
-    draw_buttons(&fb);
-    draw_footer(&fb);
-    draw_text_field(&fb);
-    esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, display_h_res, display_v_res, pax_buf_get_pixels(&fb));
+    if (rx_handlers & TOPIC_HANDLER_DISPLAY) {
+        perf_mark(PERF_MARK_RX);
+        // Only queued here, the log task does the card I/O
+        message_t message;
+        if (message_ring_get(0, &message)) {
+            message_log_append(&message);
+        }
+        power_activity();
+    }
+    if (rx_handlers & TOPIC_HANDLER_LED) {
+        led_engine_set(LED_SOURCE_MESSAGE, &led_message);
+    }
 }
 
-void render_wallpaper_clock(bool includeClock) {
-    pax_insert_png_buf(&fb, wallpaper_start, wallpaper_end - wallpaper_start, 0, 0, 0);
-    pax_draw_text(&fb, 0xFFFFFFFF, pax_font_sky_mono, 40, 180, 380, menu_title);
-    //TODO: render text Event Notifier on wallpper
-    if(includeClock){
-        char strftime_buf[64];
-
-        time(&now_time);
-        localtime_r(&now_time, &timeinfo);
-        strftime(strftime_buf, sizeof(strftime_buf), "%H:%M:%S", &timeinfo);
-        pax_draw_text(&fb, 0xFFFFFFFF, pax_font_sky_mono, 100, 100, 140, strftime_buf);
+// The topic is always shown, the routes from the settings come on top of it
+static void build_routes(void) {
+    settings_t const* current = settings_get();
+    topic_router_clear();
+    topic_router_add(current->topic, TOPIC_HANDLER_ALL);
+    for (size_t i = 0; i < current->route_count; i++) {
+        if (!topic_router_add(current->routes[i].filter, current->routes[i].handlers)) {
+            ESP_LOGW(TAG, "No room for the route on %s", current->routes[i].filter);
+        }
     }
-    //TODO: show current time 
-    esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, display_h_res, display_v_res, pax_buf_get_pixels(&fb));
-
 }
 
-void blit() {
-    if(!inactive_show_time) render_gui();
-    else render_wallpaper_clock(true);
+// Every filter in one SUBSCRIBE packet. A resumed session still has them, but the settings may
+// have changed since it was made.
+static void subscribe_routes(esp_mqtt_client_handle_t mqtt_client) {
+    esp_mqtt_topic_t topics[TOPIC_ROUTER_MAX_ROUTES];
+    size_t           count = topic_router_count();
+    for (size_t i = 0; i < count; i++) {
+        // QoS 1, so events sent while offline are kept for the session
+        topics[i] = (esp_mqtt_topic_t){.filter = topic_router_filter(i), .qos = 1};
+    }
+    if (esp_mqtt_client_subscribe_multiple(mqtt_client, topics, count) < 0) {
+        ESP_LOGE(TAG, "Failed to subscribe to %u topics", (unsigned)count);
+    }
 }
 
-
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data) {
     esp_mqtt_event_handle_t event = event_data;
     // printf("mqtt event");
     switch ((esp_mqtt_event_id_t)event_id) {
         case MQTT_EVENT_CONNECTED:
-            client = event->client;
-            ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
-            esp_mqtt_client_subscribe(client, "/esp32/coffee", 0);
-            mqtt_msg_transmit = true;
+            ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED, %s session", event->session_present ? "resumed" : "new");
+            boot_time_milestone(BOOT_MILESTONE_MQTT_CONNECTED);
+            subscribe_routes(event->client);
+            outbox_set_client(event->client, true);
+            perf_set_client(event->client, true);
+            led_engine_set(LED_SOURCE_TRANSMIT, &led_transmit);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+            outbox_set_client(event->client, false);
+            perf_set_client(event->client, false);
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            outbox_handle_published(event->msg_id);
+            break;
+        case MQTT_EVENT_DELETED:
+            outbox_handle_deleted(event->msg_id);
             break;
         case MQTT_EVENT_DATA:
-            char buffer[num_chars];
-            memset(buffer, 0, sizeof(buffer));
-            snprintf(buffer, sizeof(buffer), "data: %.*s\r\n", event->data_len, event->data);
-            add_line(buffer);
-            mqtt_msg_event = true;
+            handle_mqtt_data(event);
             break;
         default:
             break;
     }
 }
 
-static void mqtt_task(void* pvParameters) {
+// A persistent session under the device ID, so the broker keeps the subscription and queues QoS 1
+// events while the badge is offline. mqtts:// uses the transport that resumes TLS sessions.
+static void start_mqtt(void) {
+    char const*              broker   = settings_get()->broker;
     esp_mqtt_client_config_t mqtt_cfg = {
-        .broker.address.uri = MQTT_BROKER_URI,
+        .broker.address.uri                    = broker,
+        .broker.verification.crt_bundle_attach = esp_crt_bundle_attach,
+        .credentials.client_id                 = device_id,
+        .session.disable_clean_session         = true,
     };
+    if (strncmp(broker, "mqtts://", 8) == 0) {
+        mqtt_cfg.network.transport = mqtt_tls_transport_create();
+    }
 
     client = esp_mqtt_client_init(&mqtt_cfg);
+    if (client == NULL) {
+        ESP_LOGE(TAG, "Failed to create the MQTT client");
+        return;
+    }
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-    vTaskDelay(pdMS_TO_TICKS(100));
     esp_mqtt_client_start(client);
-    vTaskDelete(NULL);
 }
 
 // static void initialize_sntp_task(void* pvParameters) {
@@ -372,28 +402,114 @@ static void mqtt_task(void* pvParameters) {
 // }
 
 
-static void wifi_connection_task(void* pvParameters) {
-    wifi_connect_try_all();
-    
-    if(wifi_connection_is_connected()) {
-        if(!mqtt_initialized)
-        {
-            mqtt_initialized = true;
-            xTaskCreate(mqtt_task, "mqtt_task", 8192, NULL, 8, NULL);
-            // xTaskCreate(initialize_sntp_task, "initialize_sntp_task", 8192, NULL, 8, NULL);
-        }
-        wifi_connected = true;
-        wifi_connecting = false;
-        esp_netif_ip_info_t* ip_info = wifi_get_ip_info();
-        add_line(ip4addr_ntoa((const ip4_addr_t*)&ip_info->ip));
+// Called by the connection manager whenever the link changes
+static void wifi_status_changed(bool connected, esp_netif_ip_info_t const* ip_info) {
+    if (!connected) {
+        led_engine_set(LED_SOURCE_WIFI, &led_wifi_connecting);
+        ui_set_connection_status("Reconnecting");
+        return;
+    }
+
+    boot_time_milestone(BOOT_MILESTONE_WIFI_CONNECTED);
+    if (client == NULL) {
+        start_mqtt();
+        // xTaskCreate(initialize_sntp_task, "initialize_sntp_task", 8192, NULL, 8, NULL);
+    } else {
+        perf_count(PERF_COUNTER_WIFI_RECONNECTS);
+        // Don't sit out the MQTT client's own reconnect timeout now that the link is back
+        esp_mqtt_client_reconnect(client);
+    }
+    led_engine_set(LED_SOURCE_WIFI, &led_wifi_connected);
+    ui_set_connection_status(ip4addr_ntoa((const ip4_addr_t*)&ip_info->ip));
+}
+
+// Brings up the radio and makes the first connection in the background while the UI starts. The
+// radio has to be power cycled and verified over SDIO before ESP-Hosted can start, which takes over
+// a second; nothing else waits for that anymore.
+static void network_task(void* pvParameters) {
+    int64_t   start = esp_timer_get_time();
+    esp_err_t res   = wifi_remote_initialize();
+    start           = boot_time_phase("Radio bring-up", start);
+
+    // Status updates go to the UI, wait until app_main has set it up
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    if (res != ESP_OK) {
+        bsp_power_set_radio_state(BSP_POWER_RADIO_STATE_OFF);
+        ESP_LOGE(TAG, "WiFi radio not responding, did you flash ESP-HOSTED firmware?");
+        ui_set_connection_status("No radio");
+        led_engine_set(LED_SOURCE_WIFI, &led_wifi_down);
+        vTaskDelete(NULL);
+    }
+
+    wifi_connection_init_stack();
+    boot_time_phase("Wi-Fi stack", start);
+
+    // Connecting, and reconnecting whenever the link drops, is up to the connection manager from here
+    if (connection_manager_start(wifi_status_changed) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the connection manager");
+        ui_set_connection_status("No network");
+        led_engine_set(LED_SOURCE_WIFI, &led_wifi_down);
     }
     vTaskDelete(NULL);
 }
 
+// Mounts the SD card and checks the settings file against the snapshot the app booted with. New
+// settings need a new MQTT client and button set, so the badge restarts into them.
+static void storage_task(void* pvParameters) {
+#if defined(CONFIG_BSP_TARGET_TANMATSU) || defined(CONFIG_BSP_TARGET_KONSOOL) || \
+    defined(CONFIG_BSP_TARGET_HACKERHOTEL_2026)
+    bool sdcard_inserted = false;
+    bsp_input_read_action(BSP_INPUT_ACTION_TYPE_SD_CARD, &sdcard_inserted);
+    if (!sdcard_inserted) {
+        ESP_LOGI(TAG, "No SD card, using the stored settings");
+        vTaskDelete(NULL);
+    }
+
+    int64_t              start         = esp_timer_get_time();
+    sd_pwr_ctrl_handle_t sd_pwr_handle = initialize_sd_ldo();
+    if (sd_mount_auto(sd_pwr_handle) != ESP_OK) {
+        vTaskDelete(NULL);
+    }
+    app_state_begin_update()->sd_card_present = true;
+    app_state_end_update();
+    ESP_LOGI(TAG, "SD card mounted using %s", sd_mode_name(sd_mode()));
+#ifdef CONFIG_NOTIFIER_SD_BENCHMARK_FORMAT
+    sd_format();
+#endif
+    start = boot_time_phase("SD card", start);
+
+    if (message_log_open() != ESP_OK) {
+        ESP_LOGW(TAG, "Message log unavailable");
+    }
+
+    bool changed = settings_refresh(SETTINGS_FILE);
+    boot_time_phase("Settings check", start);
+
+    if (changed) {
+        ESP_LOGW(TAG, "Settings changed, restarting");
+        ui_set_connection_status("New settings, restarting");
+        vTaskDelay(pdMS_TO_TICKS(2000));
+        esp_restart();
+    }
+
+#ifdef CONFIG_NOTIFIER_SD_BENCHMARK
+    sd_bench_result_t bench;
+    sd_bench_run("/sd/bench.bin", CONFIG_NOTIFIER_SD_BENCHMARK_SIZE_KB * 1024, CONFIG_NOTIFIER_SD_BENCHMARK_TRANSFER,
+                 &bench);
+#endif
+#endif
+    vTaskDelete(NULL);
+}
+
 static void render_task(void* pvParameters) {
+    // First frame of the application
+    ui_set_screen(UI_SCREEN_MAIN);
+    ui_render();
+    boot_time_milestone(BOOT_MILESTONE_FIRST_FRAME);
     while(1) {
-        blit();
-        vTaskDelay(pdMS_TO_TICKS(100));
+        render_scheduler_wait();
+        ui_render();
     }
 }
 
@@ -434,7 +550,8 @@ esp_err_t apply_timezone(void) {
 
 
 void app_main(void) {
-    init();
+    int64_t start = esp_timer_get_time();
+
     // Start the GPIO interrupt service
     gpio_install_isr_service(0);
 
@@ -445,21 +562,45 @@ void app_main(void) {
         res = nvs_flash_init();
     }
     ESP_ERROR_CHECK(res);
+    start = boot_time_phase("NVS", start);
+
+    // From the snapshot in NVS, the SD card is only checked for changes once the app runs
+    if (settings_load() != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to read settings, using the defaults");
+    }
+    build_routes();
 
     // Initialize the Board Support Package
     ESP_ERROR_CHECK(bsp_device_initialize());
+    start = boot_time_phase("BSP", start);
 
+    uint8_t mac[6];
+    if (esp_efuse_mac_get_default(mac) == ESP_OK) {
+        snprintf(device_id, sizeof(device_id), "tanmatsu-%02x%02x%02x", mac[3], mac[4], mac[5]);
+    }
 
     apply_timezone();
 
+    // Drops our own events coming back, redeliveries and senders flooding the topic
+    rx_filter_init(device_id);
+    message_rx_set_filter(rx_filter_accept);
+
+    // Before the outbox, which encrypts what it publishes. Never falls back to sending in the clear:
+    // when it fails with a key set, received messages are still opened but nothing is sent.
+    if (message_crypto_init(settings_get()->key, device_id) != ESP_OK) {
+        ESP_LOGE(TAG, "Encryption is not available, events will not be sent");
+    }
+
+    // Events can arrive as soon as the network is up, so the outbox has to exist before it starts
+    ESP_ERROR_CHECK(outbox_init(outbox_status_changed));
+    ESP_ERROR_CHECK(perf_init());
+    ESP_ERROR_CHECK(message_log_init());
+
+    // The radio comes up in parallel with the display, wifi_remote_initialize power cycles it itself
+    led_engine_set(LED_SOURCE_WIFI, &led_wifi_connecting);
+    TaskHandle_t network_task_handle = NULL;
+    xTaskCreate(network_task, "network_task", 4096, NULL, 9, &network_task_handle);
 
-    ESP_LOGW(TAG, "Switching radio off...\r\n");
-    bsp_power_set_radio_state(BSP_POWER_RADIO_STATE_OFF);
-    vTaskDelay(pdMS_TO_TICKS(100));
-    ESP_LOGW(TAG, "Switching radio to application mode...\r\n");
-    bsp_power_set_radio_state(BSP_POWER_RADIO_STATE_APPLICATION);
-    vTaskDelay(pdMS_TO_TICKS(100));
-    
     ESP_ERROR_CHECK(bsp_display_get_panel(&lcd_panel));
     
     // Get display parameters and rotation
@@ -499,83 +640,97 @@ void app_main(void) {
     }
     
     // Initialize graphics stack
-    pax_buf_init(&fb, NULL, display_h_res, display_v_res, format);
-    pax_buf_reversed(&fb, display_data_endian == LCD_RGB_DATA_ENDIAN_BIG);
-    pax_buf_set_orientation(&fb, orientation);
-
-    render_wallpaper_clock(false);
-
-    if (wifi_remote_initialize() == ESP_OK) {
-        wifi_connection_init_stack();        
-    } else {
-        bsp_power_set_radio_state(BSP_POWER_RADIO_STATE_OFF);
-        ESP_LOGE(TAG, "WiFi radio not responding, did you flash ESP-HOSTED firmware?");
-        return;
+    ESP_ERROR_CHECK(panel_init(lcd_panel, display_h_res, display_v_res, format, orientation,
+                               display_data_endian == LCD_RGB_DATA_ENDIAN_BIG));
+    start = boot_time_phase("Display", start);
+    ui_init(display_h_res, display_v_res, format, orientation, display_data_endian == LCD_RGB_DATA_ENDIAN_BIG);
+    // Decoded into the background layer the first time the clock is shown, not during boot
+    ui_set_wallpaper(wallpaper_start, wallpaper_end - wallpaper_start);
+    ui_set_buttons(settings_button_labels(), settings_get()->button_count);
+    ui_set_history_source(history_count, history_get);
+    if (gif_player_init(display_h_res, display_v_res, format, orientation,
+                        display_data_endian == LCD_RGB_DATA_ENDIAN_BIG) == ESP_OK) {
+        ui_set_animation_renderer(gif_player_draw);
+        message_rx_set_event_handler(event_received);
     }
-    
+    xTaskNotifyGive(network_task_handle);
+    start = boot_time_phase("UI", start);
+
     // Get input event queue from BSP
     ESP_ERROR_CHECK(bsp_input_get_queue(&input_event_queue));
     
-    ESP_LOGW(TAG, "Hello world!");
-    
-    
-    bsp_led_initialize();
-    xTaskCreate(led_task, "led_task", 4096, NULL, 5, NULL);
-    
-    // bool sdcard_inserted = false;
-    // bsp_input_read_action(BSP_INPUT_ACTION_TYPE_SD_CARD, &sdcard_inserted);
-    
-    // if (sdcard_inserted) {
-    //     printf("SD card detected\r\n");
-    //     #if defined(CONFIG_BSP_TARGET_TANMATSU) || defined(CONFIG_BSP_TARGET_KONSOOL) || defined(CONFIG_BSP_TARGET_HACKERHOTEL_2026)
-    //     sd_pwr_ctrl_handle_t sd_pwr_handle = initialize_sd_ldo();
-    //     sd_mount_spi(sd_pwr_handle);
-    //     sd_card_present = true;
-    //     test_sd();
-    //     #endif
-    // }
+    // A: transmit, B: unused
+    if (led_engine_init() == ESP_OK) {
+        led_engine_bind(0, LED_SOURCE_BATTERY);
+        led_engine_bind(1, LED_SOURCE_WIFI);
+        led_engine_bind(2, LED_SOURCE_MESSAGE);
+        led_engine_bind(4, LED_SOURCE_TRANSMIT);
+    }
+    xTaskCreate(battery_task, "battery_task", 3072, NULL, 5, &battery_task_handle);
     
-    // xTaskCreate(wifi_task, "wifi_task", 8192, NULL, 10, NULL);
-    xTaskCreate(render_task, "render_task", 4096, NULL, 10, NULL);
+    // The card is only needed for the settings file and the offline log, mount it off the boot path
+    xTaskCreate(storage_task, "storage_task", 4096, NULL, 3, NULL);
+
+    TaskHandle_t render_task_handle = NULL;
+    xTaskCreate(render_task, "render_task", 4096, NULL, 10, &render_task_handle);
+    render_scheduler_init(render_task_handle);
+    if (power_init(power_mode_changed) != ESP_OK) {
+        ESP_LOGE(TAG, "Power management unavailable, staying at full power");
+    }
+    boot_time_phase("Tasks", start);
+
+    // Only does something when enabled in the configuration, after boot so it does not delay it
+    message_crypto_benchmark();
 
     while (1) {
         //TODO: 
         // 1. Show big clock by default, when any button is pressed show graphical interface - done
         // 2. Add graphics interface with buttons. - done
-        // 3. Parse json data received from mqtt
-        // 4. generate json data to be transmitted
-        // 5. Add encryption for messages
-        // 6. Add player that shows gifs on screen
-        // 7. read mqtt settings from sd card. Ask to continue with default settings if no sd card present
+        // 3. Parse json data received from mqtt - done
+        // 4. generate json data to be transmitted - done
+        // 5. Add encryption for messages - done
+        // 6. Add player that shows gifs on screen - done
+        // 7. read mqtt settings from sd card, use the settings stored in NVS if no sd card present - done
         // 8. Add wallpaper - done
 
         bsp_input_event_t event;
-        if(!wifi_connection_is_connected() && !wifi_connecting) {
-            wifi_connected = false;
-            wifi_connecting = true;
-            xTaskCreate(wifi_connection_task, "wifi_connection_task", 4096, NULL, 10, NULL);
-        }
         if (xQueueReceive(input_event_queue, &event, portMAX_DELAY) == pdTRUE) {
             switch (event.type) {
                 case INPUT_EVENT_TYPE_NAVIGATION: {
                     if (event.args_navigation.state) {
+                        perf_mark(PERF_MARK_INPUT);
+                        bool waking = power_get_mode() != POWER_MODE_ACTIVE;
+                        power_activity();
+                        if (waking) {
+                            break;  // A key that wakes a dimmed or blank screen only wakes it
+                        }
+                        if (gif_player_stop()) {
+                            break;  // Any key only ends a running animation
+                        }
                         switch (event.args_navigation.key) {
                             case BSP_INPUT_NAVIGATION_KEY_F1:
-                                // xTaskCreate(mqtt_publish_task, "mqtt_publish_task", 4096, "Debug: I require coffee!", 1, NULL);
-                                if(client) esp_mqtt_client_publish(client, "/esp32/coffee", "Debug: I require coffee!", 0, 1, 0);
-                                // mqtt_msg_transmit = true;
+                                post_event("Debug", "I require coffee!");
+                                break;
+                            case BSP_INPUT_NAVIGATION_KEY_F2:
+                                ui_toggle_screen(UI_SCREEN_DIAGNOSTICS);
                                 break;
                             case BSP_INPUT_NAVIGATION_KEY_RIGHT:
-                                selectNextButton(true);
+                                ui_select_next_button(true);
                                 break;
                             case BSP_INPUT_NAVIGATION_KEY_LEFT:
-                                selectNextButton(false);
+                                ui_select_next_button(false);
+                                break;
+                            case BSP_INPUT_NAVIGATION_KEY_UP:
+                                ui_scroll_history(true);
+                                break;
+                            case BSP_INPUT_NAVIGATION_KEY_DOWN:
+                                ui_scroll_history(false);
                                 break;
                             case BSP_INPUT_NAVIGATION_KEY_RETURN:
-                                button_callbacks[selected_button]();
+                                button_pressed(ui_selected_button());
                                 break;
                             case BSP_INPUT_NAVIGATION_KEY_ESC:
-                                inactive_show_time ^= 1;
+                                ui_toggle_screen(UI_SCREEN_CLOCK);
                                 break;
                             default:
                             break;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define MESSAGE_CRYPTO_MAGIC    0xE1  // First byte of a sealed message, a JSON payload starts with '{'
+#define MESSAGE_CRYPTO_TAG      16
+#define MESSAGE_CRYPTO_OVERHEAD (2 + 32 + 8 + MESSAGE_CRYPTO_TAG)  // Largest header plus the tag
+
+esp_err_t message_crypto_init(char const* secret, char const* sender);
+bool      message_crypto_enabled(void);
+esp_err_t message_crypto_seal(char const* topic, uint8_t const* plaintext, size_t length, uint8_t* out, size_t size,
+                              size_t* out_length);
+esp_err_t message_crypto_open(char const* topic, size_t topic_length, uint8_t const* sealed, size_t length,
+                              uint8_t* out, size_t size, size_t* out_length);
+void      message_crypto_benchmark(void);
@@ -0,0 +1,438 @@
+#include "message_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// Every received message, kept on the SD card. The MQTT task only copies messages into a queue;
+// a writer task collects them into batches that go to the card as one block-aligned chunk when the
+// batch is full or a few seconds old.
+//
+// Three files make up the log:
+//   messages.log  batches of records, each with a header holding a CRC over its contents and padded
+//                 to whole 512 byte sectors
+//   messages.idx  the data file offset of every record as a uint32, so record N is found in O(1)
+//   messages.jnl  two alternating slots with the committed length of both files
+//
+// A batch is committed by writing it, then its index entries, then the next journal slot, with an
+// fsync in between. After a power loss the log is rolled forward from the last valid journal slot:
+// batches behind it with a valid CRC are kept and indexed, the first torn one and everything after
+// it is cut off.
+//
+// The history reads the log through file handles of its own, so it doesn't wait for the log mutex
+// that a whole commit holds. FATFS still serialises calls on the volume, so a read can wait for
+// the single write or fsync that is running. All five files stay open while the log is, which
+// sdcard.c counts in its file handle limit.
+
+#define MESSAGE_LOG_DIRECTORY   "/sd/notifier"
+#define MESSAGE_LOG_DATA        MESSAGE_LOG_DIRECTORY "/messages.log"
+#define MESSAGE_LOG_INDEX       MESSAGE_LOG_DIRECTORY "/messages.idx"
+#define MESSAGE_LOG_JOURNAL     MESSAGE_LOG_DIRECTORY "/messages.jnl"
+#define MESSAGE_LOG_SECTOR      512
+#define MESSAGE_LOG_BATCH_SIZE  4096  // Header and records, one batch never exceeds this
+#define MESSAGE_LOG_MAX_PENDING 16
+#define MESSAGE_LOG_FLUSH_MS    2000
+#define MESSAGE_LOG_QUEUE       16
+#define MESSAGE_LOG_BATCH_MAGIC 0x324F4C4E  // "NLO2", a log in the older record layout is started over
+#define MESSAGE_LOG_JNL_MAGIC   0x324E4A4E  // "NJN2"
+
+typedef struct {
+    uint32_t magic;
+    uint16_t count;     // Records in the batch
+    uint16_t reserved;
+    uint32_t length;    // Bytes of records following the header
+    uint32_t crc;       // Over count, reserved, length and the records
+} batch_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t data_end;
+    uint32_t count;
+    uint32_t crc;
+} journal_slot_t;
+
+// Record layout: received time, message sequence number, topic length, text length, topic, text
+#define RECORD_SEQUENCE     4
+#define RECORD_TOPIC_LENGTH 8
+#define RECORD_TEXT_LENGTH  9
+#define RECORD_HEADER_SIZE  10
+
+static char const TAG[] = "message_log";
+
+static QueueHandle_t     log_queue  = NULL;
+static SemaphoreHandle_t log_mutex  = NULL;  // Writer side, held across a whole commit
+static int               data_fd    = -1;
+static int               index_fd   = -1;
+static int               journal_fd = -1;  // Kept open, so a commit never needs a free file handle
+static uint32_t          generation = 0;
+static uint32_t          data_end   = 0;  // Committed length of the data file
+static volatile uint32_t committed  = 0;  // Records on the card
+static volatile uint32_t pending    = 0;  // Records in the batch that is being collected
+static uint32_t          dropped    = 0;
+static uint32_t          boot_first = 0;      // First record received since boot, the ones before it are older
+static volatile bool     readable   = false;  // Opened and repaired
+
+// Only used by readers, under the read mutex
+static SemaphoreHandle_t read_mutex     = NULL;
+static int               read_data_fd   = -1;
+static int               read_index_fd  = -1;
+static uint32_t          read_committed = 0;  // Records on the card when the read handles were opened
+
+// The last lookup by sequence number, the history asks for the same one until a message arrives
+static uint32_t found_sequence  = UINT32_MAX;
+static uint32_t found_committed = 0;
+static uint32_t found_index     = 0;
+
+static uint8_t  batch[MESSAGE_LOG_BATCH_SIZE] __attribute__((aligned(4)));
+static size_t   batch_length  = sizeof(batch_header_t);
+static uint32_t batch_offsets[MESSAGE_LOG_MAX_PENDING];  // Relative to the batch start
+
+static uint32_t batch_crc(batch_header_t const* header, uint8_t const* records) {
+    uint32_t crc = esp_rom_crc32_le(0, (uint8_t const*)&header->count, 8);
+    return esp_rom_crc32_le(crc, records, header->length);
+}
+
+static uint32_t journal_crc(journal_slot_t const* slot) {
+    return esp_rom_crc32_le(0, (uint8_t const*)slot, offsetof(journal_slot_t, crc));
+}
+
+static size_t padded(size_t length) {
+    return (length + MESSAGE_LOG_SECTOR - 1) / MESSAGE_LOG_SECTOR * MESSAGE_LOG_SECTOR;
+}
+
+static bool read_at(int fd, uint32_t offset, void* buffer, size_t length) {
+    return lseek(fd, offset, SEEK_SET) == (off_t)offset && read(fd, buffer, length) == (ssize_t)length;
+}
+
+static bool write_at(int fd, uint32_t offset, void const* buffer, size_t length) {
+    return lseek(fd, offset, SEEK_SET) == (off_t)offset && write(fd, buffer, length) == (ssize_t)length;
+}
+
+static bool journal_write(uint32_t next_end, uint32_t next_count) {
+    journal_slot_t slot = {
+        .magic      = MESSAGE_LOG_JNL_MAGIC,
+        .generation = generation + 1,
+        .data_end   = next_end,
+        .count      = next_count,
+    };
+    slot.crc = journal_crc(&slot);
+
+    // Alternate between the slots, so a torn write leaves the previous state intact
+    bool ok = write_at(journal_fd, (slot.generation & 1) * MESSAGE_LOG_SECTOR, &slot, sizeof(slot)) &&
+              fsync(journal_fd) == 0;
+    if (ok) generation = slot.generation;
+    return ok;
+}
+
+static bool journal_read(journal_slot_t* out) {
+    bool found = false;
+    for (int i = 0; i < 2; i++) {
+        journal_slot_t slot;
+        if (read_at(journal_fd, i * MESSAGE_LOG_SECTOR, &slot, sizeof(slot)) && slot.magic == MESSAGE_LOG_JNL_MAGIC &&
+            slot.crc == journal_crc(&slot) && (!found || slot.generation > out->generation)) {
+            *out  = slot;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// Index the records of the batch in memory, whose data starts at `start` in the data file
+static bool index_batch(uint8_t const* data, batch_header_t const* header, uint32_t start, uint32_t first) {
+    size_t   offset = sizeof(batch_header_t);
+    uint32_t entries[MESSAGE_LOG_MAX_PENDING];
+    for (uint16_t i = 0; i < header->count; i++) {
+        if (i >= MESSAGE_LOG_MAX_PENDING || offset + RECORD_HEADER_SIZE > sizeof(batch_header_t) + header->length) {
+            return false;
+        }
+        entries[i]  = start + offset;
+        offset     += RECORD_HEADER_SIZE + data[offset + RECORD_TOPIC_LENGTH] + data[offset + RECORD_TEXT_LENGTH];
+    }
+    return write_at(index_fd, first * sizeof(uint32_t), entries, header->count * sizeof(uint32_t));
+}
+
+// Rolls the log forward from a committed state over the batches written after it
+static void recover(uint32_t end, uint32_t count) {
+    static uint8_t buffer[MESSAGE_LOG_BATCH_SIZE];
+    uint32_t       recovered = 0;
+
+    while (true) {
+        batch_header_t* header = (batch_header_t*)buffer;
+        if (!read_at(data_fd, end, buffer, sizeof(batch_header_t)) || header->magic != MESSAGE_LOG_BATCH_MAGIC ||
+            header->length > MESSAGE_LOG_BATCH_SIZE - sizeof(batch_header_t) ||
+            !read_at(data_fd, end + sizeof(batch_header_t), buffer + sizeof(batch_header_t), header->length) ||
+            header->crc != batch_crc(header, buffer + sizeof(batch_header_t)) ||
+            !index_batch(buffer, header, end, count)) {
+            break;
+        }
+        count     += header->count;
+        recovered += header->count;
+        end       += padded(sizeof(batch_header_t) + header->length);
+    }
+
+    // Cut off whatever was torn
+    ftruncate(data_fd, end);
+    ftruncate(index_fd, count * sizeof(uint32_t));
+    fsync(data_fd);
+    fsync(index_fd);
+    journal_write(end, count);
+
+    data_end  = end;
+    committed = count;
+    if (recovered > 0) {
+        ESP_LOGW(TAG, "Recovered %lu messages that were not committed", (unsigned long)recovered);
+    }
+}
+
+// Opens the log on the mounted SD card and repairs it if needed. Batches collected before the card
+// was available are written on the next flush.
+esp_err_t message_log_open(void) {
+    mkdir(MESSAGE_LOG_DIRECTORY, 0775);
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+    data_fd    = open(MESSAGE_LOG_DATA, O_RDWR | O_CREAT, 0666);
+    index_fd   = open(MESSAGE_LOG_INDEX, O_RDWR | O_CREAT, 0666);
+    journal_fd = open(MESSAGE_LOG_JOURNAL, O_RDWR | O_CREAT, 0666);
+    if (data_fd < 0 || index_fd < 0 || journal_fd < 0) {
+        ESP_LOGE(TAG, "Failed to open the log: %s", strerror(errno));
+        if (data_fd >= 0) close(data_fd);
+        if (index_fd >= 0) close(index_fd);
+        if (journal_fd >= 0) close(journal_fd);
+        data_fd = index_fd = journal_fd = -1;
+        xSemaphoreGive(log_mutex);
+        return ESP_FAIL;
+    }
+
+    // Without a journal, or with an index that lost entries the journal claims, rebuild from scratch
+    journal_slot_t slot;
+    struct stat    index_stat;
+    if (!journal_read(&slot) || fstat(index_fd, &index_stat) != 0 ||
+        index_stat.st_size < (off_t)(slot.count * sizeof(uint32_t))) {
+        slot.generation = 0;
+        slot.data_end   = 0;
+        slot.count      = 0;
+    }
+    generation = slot.generation;
+    recover(slot.data_end, slot.count);
+    boot_first = committed;
+    readable   = true;
+    xSemaphoreGive(log_mutex);
+
+    ESP_LOGI(TAG, "%lu messages in the log", (unsigned long)committed);
+    return ESP_OK;
+}
+
+static void reset_batch(void) {
+    batch_length = sizeof(batch_header_t);
+    pending      = 0;
+}
+
+// Commits the collected batch. Without a card the batch is kept, to be written once there is one.
+static void flush(void) {
+    if (pending == 0) return;
+
+    xSemaphoreTake(log_mutex, portMAX_DELAY);
+    if (data_fd < 0) {
+        xSemaphoreGive(log_mutex);
+        return;
+    }
+
+    batch_header_t* header = (batch_header_t*)batch;
+    header->magic          = MESSAGE_LOG_BATCH_MAGIC;
+    header->count          = pending;
+    header->reserved       = 0;
+    header->length         = batch_length - sizeof(batch_header_t);
+    header->crc            = batch_crc(header, batch + sizeof(batch_header_t));
+
+    // Zero padding up to the sector boundary, so only whole sectors are written
+    size_t size = padded(batch_length);
+    memset(batch + batch_length, 0, size - batch_length);
+    for (uint32_t i = 0; i < pending; i++) {
+        batch_offsets[i] += data_end;
+    }
+
+    bool ok = write_at(data_fd, data_end, batch, size) && fsync(data_fd) == 0 &&
+              write_at(index_fd, committed * sizeof(uint32_t), batch_offsets, pending * sizeof(uint32_t)) &&
+              fsync(index_fd) == 0 && journal_write(data_end + size, committed + pending);
+    if (ok) {
+        data_end  += size;
+        committed += pending;
+    } else {
+        // Whatever made it to the card is cut off again by the recovery on the next boot
+        ESP_LOGE(TAG, "Failed to write %lu messages", (unsigned long)pending);
+        dropped += pending;
+    }
+    reset_batch();
+    xSemaphoreGive(log_mutex);
+}
+
+static void append_record(message_t const* message) {
+    size_t topic_length = strnlen(message->topic, sizeof(message->topic) - 1);
+    size_t text_length  = strnlen(message->text, sizeof(message->text) - 1);
+    size_t size         = RECORD_HEADER_SIZE + topic_length + text_length;
+    if (batch_length + size > MESSAGE_LOG_BATCH_SIZE || pending == MESSAGE_LOG_MAX_PENDING) {
+        flush();
+    }
+    if (pending > 0 && (batch_length + size > MESSAGE_LOG_BATCH_SIZE || pending == MESSAGE_LOG_MAX_PENDING)) {
+        dropped += pending;  // Still no card, make room for the newer messages
+        reset_batch();
+    }
+
+    uint8_t* record = batch + batch_length;
+    uint32_t time   = (uint32_t)message->received;
+    memcpy(record, &time, sizeof(time));
+    memcpy(record + RECORD_SEQUENCE, &message->sequence, sizeof(message->sequence));
+    record[RECORD_TOPIC_LENGTH] = topic_length;
+    record[RECORD_TEXT_LENGTH]  = text_length;
+    memcpy(record + RECORD_HEADER_SIZE, message->topic, topic_length);
+    memcpy(record + RECORD_HEADER_SIZE + topic_length, message->text, text_length);
+
+    batch_offsets[pending]  = batch_length;
+    batch_length           += size;
+    pending++;
+}
+
+static void message_log_task(void* pvParameters) {
+    static message_t message;
+    TickType_t       batch_started = 0;
+
+    while (1) {
+        TickType_t timeout = portMAX_DELAY;
+        if (pending > 0) {
+            TickType_t age = xTaskGetTickCount() - batch_started;
+            timeout        = age < pdMS_TO_TICKS(MESSAGE_LOG_FLUSH_MS) ? pdMS_TO_TICKS(MESSAGE_LOG_FLUSH_MS) - age : 0;
+        }
+
+        if (xQueueReceive(log_queue, &message, timeout) == pdTRUE) {
+            if (pending == 0) batch_started = xTaskGetTickCount();
+            append_record(&message);
+            if (pending == MESSAGE_LOG_MAX_PENDING) flush();
+        } else {
+            flush();
+            batch_started = xTaskGetTickCount();
+        }
+    }
+}
+
+esp_err_t message_log_init(void) {
+    log_queue = xQueueCreate(MESSAGE_LOG_QUEUE, sizeof(message_t));
+    log_mutex  = xSemaphoreCreateMutex();
+    read_mutex = xSemaphoreCreateMutex();
+    if (log_queue == NULL || log_mutex == NULL || read_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(message_log_task, "message_log", 3072, NULL, 3, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Called from the MQTT task, never blocks and never touches the card
+void message_log_append(message_t const* message) {
+    if (log_queue == NULL || xQueueSend(log_queue, message, 0) != pdTRUE) {
+        dropped++;
+    }
+}
+
+// Messages on the card, including those of earlier boots
+uint32_t message_log_count(void) {
+    return committed;
+}
+
+static void close_readers(void) {
+    if (read_data_fd >= 0) close(read_data_fd);
+    if (read_index_fd >= 0) close(read_index_fd);
+    read_data_fd = read_index_fd = -1;
+}
+
+// With the read mutex held. A FAT file handle keeps the file size from when it was opened, so the
+// read handles are opened again after every commit, which only happens every few seconds.
+static bool open_readers(void) {
+    uint32_t count = committed;
+    if (read_data_fd >= 0 && read_index_fd >= 0 && read_committed == count) {
+        return true;
+    }
+    close_readers();
+    read_data_fd   = open(MESSAGE_LOG_DATA, O_RDONLY);
+    read_index_fd  = open(MESSAGE_LOG_INDEX, O_RDONLY);
+    read_committed = count;
+    if (read_data_fd < 0 || read_index_fd < 0) {
+        close_readers();
+        return false;
+    }
+    return true;
+}
+
+static bool read_sequence(uint32_t index, uint32_t* sequence) {
+    uint32_t offset = 0;
+    return read_at(read_index_fd, index * sizeof(uint32_t), &offset, sizeof(offset)) &&
+           read_at(read_data_fd, offset + RECORD_SEQUENCE, sequence, sizeof(*sequence));
+}
+
+// Number of records that come before message `sequence` of this boot: all of the earlier boots and
+// the ones of this boot with a lower number. Messages can be dropped on their way to the card, so
+// the position of a message is looked up by its number instead of worked out from a count.
+uint32_t message_log_find(uint32_t sequence) {
+    if (!readable) {
+        return 0;
+    }
+
+    xSemaphoreTake(read_mutex, portMAX_DELAY);
+    if (sequence != found_sequence || committed != found_committed) {
+        // The records of this boot were written in the order of their numbers
+        bool     opened = open_readers();
+        uint32_t low    = boot_first;
+        uint32_t high   = opened ? read_committed : boot_first;
+        while (low < high) {
+            uint32_t middle = low + (high - low) / 2;
+            uint32_t found  = 0;
+            if (read_sequence(middle, &found) && found < sequence) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        found_sequence  = sequence;
+        found_committed = read_committed;
+        found_index     = low;
+    }
+    uint32_t index = found_index;
+    xSemaphoreGive(read_mutex);
+    return index;
+}
+
+// Reads message `index` (0 is the oldest) from the card, false when it is not on the card (yet)
+bool message_log_read(uint32_t index, message_t* out) {
+    if (!readable || index >= committed) {
+        return false;
+    }
+
+    xSemaphoreTake(read_mutex, portMAX_DELAY);
+    uint32_t offset = 0;
+    uint8_t  header[RECORD_HEADER_SIZE];
+    uint8_t* lengths = header + RECORD_TOPIC_LENGTH;  // Topic, then text
+    bool     ok      = open_readers() && index < read_committed &&
+              read_at(read_index_fd, index * sizeof(uint32_t), &offset, sizeof(offset)) &&
+              read_at(read_data_fd, offset, header, sizeof(header)) && lengths[0] < sizeof(out->topic) &&
+              lengths[1] < sizeof(out->text) && read(read_data_fd, out->topic, lengths[0]) == lengths[0] &&
+              read(read_data_fd, out->text, lengths[1]) == lengths[1];
+    if (ok) {
+        uint32_t time;
+        memcpy(&time, header, sizeof(time));
+        memcpy(&out->sequence, header + RECORD_SEQUENCE, sizeof(out->sequence));
+        out->received          = time;
+        out->topic[lengths[0]] = '\0';
+        out->text[lengths[1]]  = '\0';
+    }
+    xSemaphoreGive(read_mutex);
+    return ok;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "message_ring.h"
+
+esp_err_t message_log_init(void);
+esp_err_t message_log_open(void);
+void      message_log_append(message_t const* message);
+uint32_t  message_log_count(void);
+uint32_t  message_log_find(uint32_t sequence);
+bool      message_log_read(uint32_t index, message_t* out);
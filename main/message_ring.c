@@ -0,0 +1,65 @@
+#include "message_ring.h"
+#include <stdatomic.h>
+#include <string.h>
+
+// History of the most recent messages. There is a single writer (the MQTT task) that never waits:
+// when the ring is full the oldest entry is overwritten. Readers never remove anything and never
+// block the writer; every slot carries a sequence number that is odd while the slot is being
+// written, so a reader can detect and discard a copy that raced with the writer.
+
+typedef struct {
+    atomic_uint_fast32_t sequence;
+    message_t            message;
+} message_slot_t;
+
+static message_slot_t       slots[MESSAGE_RING_CAPACITY];
+static atomic_uint_fast32_t head = 0;  // Number of messages ever pushed
+
+static void copy_sanitized(char* dst, size_t dst_size, char const* src, size_t src_len) {
+    size_t length = src_len < dst_size - 1 ? src_len : dst_size - 1;
+    for (size_t i = 0; i < length; i++) {
+        char c = src[i];
+        dst[i] = (c == '\r' || c == '\n' || c == '\0') ? ' ' : c;
+    }
+    dst[length] = '\0';
+}
+
+void message_ring_push(char const* topic, size_t topic_len, char const* text, size_t text_len) {
+    uint32_t        index = atomic_load_explicit(&head, memory_order_relaxed);
+    message_slot_t* slot  = &slots[index & (MESSAGE_RING_CAPACITY - 1)];
+
+    atomic_store_explicit(&slot->sequence, index * 2 + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    time(&slot->message.received);
+    slot->message.sequence = index;
+    copy_sanitized(slot->message.topic, sizeof(slot->message.topic), topic, topic_len);
+    copy_sanitized(slot->message.text, sizeof(slot->message.text), text, text_len);
+
+    atomic_store_explicit(&slot->sequence, index * 2 + 2, memory_order_release);
+    atomic_store_explicit(&head, index + 1, memory_order_release);
+}
+
+// Also serves as a version number: it changes whenever a message is added
+uint32_t message_ring_count(void) {
+    return atomic_load_explicit(&head, memory_order_acquire);
+}
+
+// Copy the message pushed `age` messages ago (0 is the newest), false if it no longer exists
+bool message_ring_get(uint32_t age, message_t* out) {
+    uint32_t count = atomic_load_explicit(&head, memory_order_acquire);
+    if (age >= count || age >= MESSAGE_RING_CAPACITY) {
+        return false;
+    }
+
+    uint32_t        index    = count - 1 - age;
+    uint32_t        expected = index * 2 + 2;
+    message_slot_t* slot     = &slots[index & (MESSAGE_RING_CAPACITY - 1)];
+
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != expected) {
+        return false;
+    }
+    memcpy(out, &slot->message, sizeof(message_t));
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&slot->sequence, memory_order_relaxed) == expected;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MESSAGE_RING_CAPACITY 32  // Must be a power of two
+#define MESSAGE_TOPIC_LENGTH  48
+#define MESSAGE_TEXT_LENGTH   60
+
+typedef struct {
+    time_t   received;
+    uint32_t sequence;  // Counts every message shown since boot, the SD card log finds messages by it
+    char     topic[MESSAGE_TOPIC_LENGTH];
+    char     text[MESSAGE_TEXT_LENGTH];
+} message_t;
+
+void     message_ring_push(char const* topic, size_t topic_len, char const* text, size_t text_len);
+uint32_t message_ring_count(void);
+bool     message_ring_get(uint32_t age, message_t* out);
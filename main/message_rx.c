@@ -0,0 +1,82 @@
+#include "message_rx.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "event_json.h"
+#include "latency.h"
+#include "message_ring.h"
+#include "topic_router.h"
+#include "ui.h"
+
+// Receive state for the message currently being delivered, possibly in several fragments. Event
+// JSON is parsed while the fragments arrive; payloads that are not JSON are shown as plain text.
+// The handlers of the route the topic matched decide where the message goes.
+
+static event_json_parser_t    rx_parser;
+static event_json_event_t     rx_event;
+static char                   rx_topic[MESSAGE_TOPIC_LENGTH];
+static size_t                 rx_topic_length = 0;
+static char                   rx_raw[MESSAGE_TEXT_LENGTH];
+static size_t                 rx_raw_length    = 0;
+static uint8_t                rx_handlers      = 0;
+static message_rx_event_cb_t  rx_event_handler = NULL;
+static message_rx_filter_cb_t rx_filter        = NULL;
+
+static void format_event_line(char* line, size_t size, event_json_event_t const* event) {
+    bool has_sender  = event->fields & EVENT_JSON_FIELD_SENDER;
+    bool has_message = event->fields & EVENT_JSON_FIELD_MESSAGE;
+    snprintf(line, size, "%s%s%s%s%s", has_sender ? event->sender : "", has_sender ? ": " : "", event->type,
+             has_message && event->type[0] ? " - " : "", has_message ? event->message : "");
+}
+
+void message_rx_set_event_handler(message_rx_event_cb_t handler) {
+    rx_event_handler = handler;
+}
+
+void message_rx_set_filter(message_rx_filter_cb_t filter) {
+    rx_filter = filter;
+}
+
+void message_rx_begin(char const* topic, size_t topic_len, uint8_t handlers) {
+    event_json_init(&rx_parser, &rx_event);
+    rx_handlers     = handlers;
+    rx_topic_length = topic_len < sizeof(rx_topic) ? topic_len : sizeof(rx_topic);
+    memcpy(rx_topic, topic, rx_topic_length);
+    rx_raw_length = 0;
+}
+
+void message_rx_feed(char const* data, size_t len) {
+    // Keep the start of the payload for senders that do not use JSON
+    size_t raw = len < sizeof(rx_raw) - rx_raw_length ? len : sizeof(rx_raw) - rx_raw_length;
+    memcpy(rx_raw + rx_raw_length, data, raw);
+    rx_raw_length += raw;
+
+    event_json_feed(&rx_parser, data, len);
+}
+
+// Returns false when the filter dropped the message
+bool message_rx_end(void) {
+    bool parsed = event_json_finish(&rx_parser) == EVENT_JSON_DONE;
+    if (rx_filter != NULL && !rx_filter(rx_topic, rx_topic_length, parsed ? &rx_event : NULL)) {
+        return false;
+    }
+
+    if (parsed) {
+        uint32_t traced = EVENT_JSON_FIELD_SENDER | EVENT_JSON_FIELD_SEQUENCE | EVENT_JSON_FIELD_TIMESTAMP;
+        if ((rx_handlers & TOPIC_HANDLER_STATS) && (rx_event.fields & traced) == traced) {
+            latency_received(rx_event.sender, rx_event.sequence, rx_event.timestamp);
+        }
+
+        if (rx_handlers & TOPIC_HANDLER_DISPLAY) {
+            char line[MESSAGE_TEXT_LENGTH];
+            format_event_line(line, sizeof(line), &rx_event);
+            ui_add_message(rx_topic, rx_topic_length, line, strlen(line));
+        }
+        if ((rx_handlers & TOPIC_HANDLER_ANIMATION) && rx_event_handler != NULL) {
+            rx_event_handler(&rx_event);
+        }
+    } else if (rx_handlers & TOPIC_HANDLER_DISPLAY) {
+        ui_add_message(rx_topic, rx_topic_length, rx_raw, rx_raw_length);
+    }
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "event_json.h"
+
+// Called for every event that parsed on a topic routed to the animation handler
+typedef void (*message_rx_event_cb_t)(event_json_event_t const* event);
+
+// Decides whether a message is handled at all, event is NULL for a payload that is not an event
+typedef bool (*message_rx_filter_cb_t)(char const* topic, size_t topic_len, event_json_event_t const* event);
+
+void message_rx_begin(char const* topic, size_t topic_len, uint8_t handlers);
+void message_rx_feed(char const* data, size_t len);
+bool message_rx_end(void);
+void message_rx_set_event_handler(message_rx_event_cb_t handler);
+void message_rx_set_filter(message_rx_filter_cb_t filter);
@@ -0,0 +1,186 @@
+// Before any mbedTLS header: the master secret of a session has no getter
+#define MBEDTLS_ALLOW_PRIVATE_ACCESS
+
+#include "mqtt_tls.h"
+#include <inttypes.h>
+#include <string.h>
+#include <sys/select.h>
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "mbedtls/platform_util.h"
+#include "mbedtls/ssl.h"
+#include "perf.h"
+
+// TLS transport for mqtts:// brokers that resumes the previous TLS session on reconnect. The stock
+// SSL transport does a full handshake every time the link drops, which costs an ECDHE exchange and
+// certificate chain verification; here the session (ticket or ID) of the last handshake is kept
+// and offered again, so a reconnect after a Wi-Fi blip is a single round trip with symmetric
+// crypto only. The session is kept in RAM: the power manager only uses light sleep, which keeps
+// RAM powered, so it survives every sleep the badge takes. A broker can always answer an offered
+// session with a full handshake, so resumption is only counted when the handshake actually reused
+// the session.
+
+#define MQTT_TLS_DEFAULT_PORT 8883
+
+static char const TAG[] = "mqtt_tls";
+
+// Only the MQTT task uses the transport
+static esp_tls_t*                tls     = NULL;
+static esp_tls_client_session_t* session = NULL;
+static unsigned char             session_master[48];  // Master secret of the session of the last handshake
+
+static void forget_session(void) {
+    esp_tls_free_client_session(session);
+    session = NULL;
+    mbedtls_platform_zeroize(session_master, sizeof(session_master));
+}
+
+// Master secret of the session the last handshake established
+static unsigned char const* handshake_master(void) {
+    mbedtls_ssl_context* ssl = esp_tls_get_ssl_context(tls);
+    if (ssl == NULL || ssl->MBEDTLS_PRIVATE(session) == NULL) {
+        return NULL;
+    }
+    return ssl->MBEDTLS_PRIVATE(session)->MBEDTLS_PRIVATE(master);
+}
+
+// A resumed TLS 1.2 session keeps the master secret of the session it resumes, a full handshake
+// derives a new one
+static bool session_resumed(bool offered) {
+    unsigned char const* master = handshake_master();
+    return offered && master != NULL && memcmp(master, session_master, sizeof(session_master)) == 0;
+}
+
+static int tls_close(esp_transport_handle_t transport) {
+    if (tls != NULL) {
+        esp_tls_conn_destroy(tls);
+        tls = NULL;
+    }
+    return 0;
+}
+
+static int tls_connect(esp_transport_handle_t transport, char const* host, int port, int timeout_ms) {
+    tls_close(transport);
+    tls = esp_tls_init();
+    if (tls == NULL) {
+        return -1;
+    }
+
+    bool offered = session != NULL;
+
+    esp_tls_cfg_t config = {
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms        = timeout_ms,
+        .client_session    = session,
+    };
+
+    int64_t start = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &config, tls) != 1) {
+        ESP_LOGW(TAG, "TLS connection to %s failed", host);
+        tls_close(transport);
+        // The broker may have forgotten the session, the next attempt does a full handshake
+        if (offered) {
+            forget_session();
+        }
+        return -1;
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    bool    resumed = session_resumed(offered);
+    perf_record(resumed ? PERF_HIST_TLS_RESUMED : PERF_HIST_TLS_FULL, elapsed);
+    ESP_LOGI(TAG, "TLS handshake with %s: %" PRId64 " ms (%s)", host, elapsed / 1000, resumed ? "resumed" : "full");
+
+    // Every handshake may hand out a new ticket, keep the newest
+    esp_tls_client_session_t* latest = esp_tls_get_client_session(tls);
+    if (latest != NULL) {
+        if (session != NULL) {
+            esp_tls_free_client_session(session);
+        }
+        session = latest;
+
+        unsigned char const* master = handshake_master();
+        if (master != NULL) {
+            memcpy(session_master, master, sizeof(session_master));
+        } else {
+            mbedtls_platform_zeroize(session_master, sizeof(session_master));
+        }
+    }
+    return 0;
+}
+
+static int tls_poll(int timeout_ms, bool write) {
+    int fd = -1;
+    if (tls == NULL || esp_tls_get_conn_sockfd(tls, &fd) != ESP_OK || fd < 0) {
+        return -1;
+    }
+
+    fd_set ready, errors;
+    FD_ZERO(&ready);
+    FD_ZERO(&errors);
+    FD_SET(fd, &ready);
+    FD_SET(fd, &errors);
+    struct timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+    int            ret     = select(fd + 1, write ? NULL : &ready, write ? &ready : NULL, &errors,
+                                    timeout_ms < 0 ? NULL : &timeout);
+    if (ret > 0 && FD_ISSET(fd, &errors)) {
+        return -1;
+    }
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t transport, int timeout_ms) {
+    // Records already decrypted by mbedTLS are not visible on the socket
+    if (tls != NULL && esp_tls_get_bytes_avail(tls) > 0) {
+        return 1;
+    }
+    return tls_poll(timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t transport, int timeout_ms) {
+    return tls_poll(timeout_ms, true);
+}
+
+// 0 is a timeout for the MQTT client, the connection is only closed on errors
+static int tls_read(esp_transport_handle_t transport, char* buffer, int length, int timeout_ms) {
+    int ready = tls_poll_read(transport, timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+    ssize_t ret = esp_tls_conn_read(tls, buffer, length);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return 0;
+    }
+    if (ret == 0) {
+        return -1;  // Closed by the broker
+    }
+    return ret;
+}
+
+static int tls_write(esp_transport_handle_t transport, char const* buffer, int length, int timeout_ms) {
+    int ready = tls_poll_write(transport, timeout_ms);
+    if (ready <= 0) {
+        return ready;
+    }
+    ssize_t ret = esp_tls_conn_write(tls, buffer, length);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return 0;
+    }
+    return ret;
+}
+
+static int tls_destroy(esp_transport_handle_t transport) {
+    return tls_close(transport);
+}
+
+// Handed to the MQTT client, which destroys it together with the client
+esp_transport_handle_t mqtt_tls_transport_create(void) {
+    esp_transport_handle_t transport = esp_transport_init();
+    if (transport == NULL) {
+        return NULL;
+    }
+    esp_transport_set_func(transport, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write,
+                           tls_destroy);
+    esp_transport_set_default_port(transport, MQTT_TLS_DEFAULT_PORT);
+    return transport;
+}
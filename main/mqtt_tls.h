@@ -0,0 +1,5 @@
+#pragma once
+
+#include "esp_transport.h"
+
+esp_transport_handle_t mqtt_tls_transport_create(void);
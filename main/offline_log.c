@@ -0,0 +1,230 @@
+#include "offline_log.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "outbox.h"
+#include "sdcard.h"
+
+// Persistent log of events that could not be published because the device was offline. Records
+// are appended to NVS, or to a file on the SD card when one is mounted. When the connection comes
+// back the log is read once, records of the same event are coalesced, records that are too old are
+// dropped, and the log is cleared. Only the outbox task appends and flushes, so a key press never
+// waits for the flash or the card.
+
+#define OFFLINE_LOG_MAX_RECORDS 32
+#define OFFLINE_LOG_MAX_AGE_S   (60 * 60)
+#define OFFLINE_LOG_NAMESPACE   "outbox"
+#define OFFLINE_LOG_DIRECTORY   "/sd/notifier"
+#define OFFLINE_LOG_FILE        OFFLINE_LOG_DIRECTORY "/outbox.log"
+#define OFFLINE_LOG_RECORD_SIZE (sizeof(uint32_t) + OUTBOX_TOPIC_LENGTH + OUTBOX_PAYLOAD_LENGTH)
+
+typedef struct {
+    uint32_t timestamp;
+    size_t   count;
+    char     topic[OUTBOX_TOPIC_LENGTH];
+    char     payload[OUTBOX_PAYLOAD_LENGTH];
+} offline_record_t;
+
+static char const TAG[] = "offline_log";
+
+// Only used while flushing, kept out of the caller's stack
+static offline_record_t records[OFFLINE_LOG_MAX_RECORDS];
+static size_t           record_count = 0;
+
+// Record layout: timestamp (4 bytes, little endian), topic, NUL, payload, NUL
+static size_t encode_record(uint8_t* buffer, uint32_t timestamp, char const* topic, char const* payload) {
+    size_t topic_length   = strnlen(topic, OUTBOX_TOPIC_LENGTH - 1);
+    size_t payload_length = strnlen(payload, OUTBOX_PAYLOAD_LENGTH - 1);
+    memcpy(buffer, &timestamp, sizeof(uint32_t));
+    memcpy(buffer + sizeof(uint32_t), topic, topic_length);
+    buffer[sizeof(uint32_t) + topic_length] = '\0';
+    memcpy(buffer + sizeof(uint32_t) + topic_length + 1, payload, payload_length);
+    buffer[sizeof(uint32_t) + topic_length + 1 + payload_length] = '\0';
+    return sizeof(uint32_t) + topic_length + payload_length + 2;
+}
+
+static bool decode_record(uint8_t const* buffer, size_t length, offline_record_t* record) {
+    if (length < sizeof(uint32_t) + 2 || buffer[length - 1] != '\0') {
+        return false;
+    }
+    char const* topic          = (char const*)buffer + sizeof(uint32_t);
+    size_t      topic_length   = strnlen(topic, length - sizeof(uint32_t));
+    size_t      payload_offset = sizeof(uint32_t) + topic_length + 1;
+    if (payload_offset >= length || topic_length >= OUTBOX_TOPIC_LENGTH ||
+        length - payload_offset > OUTBOX_PAYLOAD_LENGTH) {
+        return false;
+    }
+    memcpy(&record->timestamp, buffer, sizeof(uint32_t));
+    memcpy(record->topic, topic, topic_length + 1);
+    memcpy(record->payload, buffer + payload_offset, length - payload_offset);
+    record->count = 1;
+    return true;
+}
+
+static uint8_t checksum(uint8_t const* data, size_t length) {
+    uint8_t sum = 0x5A;
+    for (size_t i = 0; i < length; i++) {
+        sum = (sum << 1 | sum >> 7) ^ data[i];
+    }
+    return sum;
+}
+
+// Collect a record, merging it into an earlier one for the same event
+static void collect_record(offline_record_t const* record, uint32_t now) {
+    if (now > OFFLINE_LOG_MAX_AGE_S && record->timestamp < now - OFFLINE_LOG_MAX_AGE_S) {
+        return;
+    }
+    for (size_t i = 0; i < record_count; i++) {
+        if (strcmp(records[i].topic, record->topic) == 0 && strcmp(records[i].payload, record->payload) == 0) {
+            records[i].count++;
+            if (record->timestamp > records[i].timestamp) {
+                records[i].timestamp = record->timestamp;
+            }
+            return;
+        }
+    }
+    if (record_count < OFFLINE_LOG_MAX_RECORDS) {
+        records[record_count++] = *record;
+    }
+}
+
+static bool sd_available(void) {
+    return sd_status() == SD_STATUS_OK;
+}
+
+static esp_err_t sd_append(uint8_t const* data, size_t length) {
+    mkdir(OFFLINE_LOG_DIRECTORY, 0775);
+    FILE* file = fopen(OFFLINE_LOG_FILE, "ab");
+    if (file == NULL) {
+        return ESP_FAIL;
+    }
+
+    // Keep the file bounded, a full log only accepts records again after a flush
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) >= (long)(OFFLINE_LOG_MAX_RECORDS * (OFFLINE_LOG_RECORD_SIZE + 2))) {
+        fclose(file);
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t header[2] = {length, checksum(data, length)};
+    bool    ok        = fwrite(header, 1, 2, file) == 2 && fwrite(data, 1, length, file) == length;
+    ok                = fclose(file) == 0 && ok;
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+static void sd_collect(uint32_t now) {
+    FILE* file = fopen(OFFLINE_LOG_FILE, "rb");
+    if (file == NULL) {
+        return;
+    }
+    uint8_t header[2];
+    uint8_t buffer[OFFLINE_LOG_RECORD_SIZE];
+    while (fread(header, 1, 2, file) == 2) {
+        if (header[0] > sizeof(buffer) || fread(buffer, 1, header[0], file) != header[0]) {
+            break;  // Torn write at the end of the log
+        }
+        offline_record_t record;
+        if (checksum(buffer, header[0]) == header[1] && decode_record(buffer, header[0], &record)) {
+            collect_record(&record, now);
+        }
+    }
+    fclose(file);
+    remove(OFFLINE_LOG_FILE);
+}
+
+static esp_err_t nvs_append(uint8_t const* data, size_t length) {
+    nvs_handle_t handle;
+    esp_err_t    res = nvs_open(OFFLINE_LOG_NAMESPACE, NVS_READWRITE, &handle);
+    if (res != ESP_OK) {
+        return res;
+    }
+
+    uint32_t head = 0, tail = 0;
+    nvs_get_u32(handle, "head", &head);
+    nvs_get_u32(handle, "tail", &tail);
+
+    char key[8];
+    snprintf(key, sizeof(key), "r%u", (unsigned)(head % OFFLINE_LOG_MAX_RECORDS));
+    res = nvs_set_blob(handle, key, data, length);
+    if (res == ESP_OK) {
+        head++;
+        // Overwrite the oldest record when full
+        if (head - tail > OFFLINE_LOG_MAX_RECORDS) {
+            tail = head - OFFLINE_LOG_MAX_RECORDS;
+            nvs_set_u32(handle, "tail", tail);
+        }
+        res = nvs_set_u32(handle, "head", head);
+    }
+    if (res == ESP_OK) {
+        res = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return res;
+}
+
+static void nvs_collect(uint32_t now) {
+    nvs_handle_t handle;
+    if (nvs_open(OFFLINE_LOG_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+
+    uint32_t head = 0, tail = 0;
+    nvs_get_u32(handle, "head", &head);
+    nvs_get_u32(handle, "tail", &tail);
+
+    uint8_t buffer[OFFLINE_LOG_RECORD_SIZE];
+    for (uint32_t index = tail; index != head; index++) {
+        char key[8];
+        snprintf(key, sizeof(key), "r%u", (unsigned)(index % OFFLINE_LOG_MAX_RECORDS));
+        size_t           length = sizeof(buffer);
+        offline_record_t record;
+        if (nvs_get_blob(handle, key, buffer, &length) == ESP_OK && decode_record(buffer, length, &record)) {
+            collect_record(&record, now);
+        }
+        nvs_erase_key(handle, key);
+    }
+
+    nvs_set_u32(handle, "tail", head);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+esp_err_t offline_log_append(char const* topic, char const* payload) {
+    uint8_t  buffer[OFFLINE_LOG_RECORD_SIZE];
+    uint32_t now    = time(NULL);
+    size_t   length = encode_record(buffer, now, topic, payload);
+
+    esp_err_t res = ESP_FAIL;
+    if (sd_available()) {
+        res = sd_append(buffer, length);
+    }
+    if (res != ESP_OK) {
+        res = nvs_append(buffer, length);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store \"%s\" (%s)", payload, esp_err_to_name(res));
+    }
+    return res;
+}
+
+// Read both logs, clear them and hand every distinct event to the callback once
+size_t offline_log_flush(offline_log_flush_cb_t callback) {
+    uint32_t now = time(NULL);
+
+    record_count = 0;
+    nvs_collect(now);
+    if (sd_available()) {
+        sd_collect(now);
+    }
+
+    for (size_t i = 0; i < record_count; i++) {
+        ESP_LOGI(TAG, "Flushing \"%s\" (pressed %u times)", records[i].payload, (unsigned)records[i].count);
+        callback(records[i].topic, records[i].payload, records[i].count);
+    }
+    return record_count;
+}
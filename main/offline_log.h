@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef void (*offline_log_flush_cb_t)(char const* topic, char const* payload, size_t count);
+
+esp_err_t offline_log_append(char const* topic, char const* payload);
+size_t    offline_log_flush(offline_log_flush_cb_t callback);
@@ -0,0 +1,315 @@
+#include "outbox.h"
+#include <string.h>
+#include "esp_log.h"
+#include "event_json.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "latency.h"
+#include "message_crypto.h"
+#include "offline_log.h"
+#include "perf.h"
+
+// Messages to publish are queued here by the input loop and published by a single task, so a
+// key press never waits for the network. Identical messages posted within a short window are
+// coalesced into one, and broker acknowledgements are reported back through a status callback.
+// While offline the task writes messages to the persistent offline log instead, which is flushed as
+// one batch as soon as the client connects. Event JSON payloads are stamped with a sequence number and
+// the send time when they are actually published, so receivers can measure latency and loss. With
+// a group key configured, payloads are encrypted right before they are published.
+
+#define OUTBOX_QUEUE_LENGTH 8
+#define OUTBOX_COALESCE_MS  2000
+#define OUTBOX_RECENT       4
+#define OUTBOX_PENDING      8
+#define OUTBOX_RETRY_MS     500
+#define OUTBOX_EARLY_ACKS   4
+#define OUTBOX_EARLY_ACK_MS 1000
+
+typedef struct {
+    char topic[OUTBOX_TOPIC_LENGTH];
+    char payload[OUTBOX_PAYLOAD_LENGTH];
+} outbox_item_t;
+
+typedef struct {
+    uint32_t   hash;
+    TickType_t posted;
+} outbox_recent_t;
+
+typedef struct {
+    int     msg_id;
+    int64_t sent;  // perf_now() at publish
+    char    payload[OUTBOX_PAYLOAD_LENGTH];
+} outbox_pending_t;
+
+// An acknowledgement handled before the publisher task recorded the message as pending
+typedef struct {
+    int        msg_id;  // 0 for a free slot
+    bool       delivered;
+    int64_t    acked;    // perf_now() when handled
+    TickType_t arrived;  // To forget acknowledgements that never find their message
+} outbox_early_ack_t;
+
+static char const TAG[] = "outbox";
+
+static QueueHandle_t            outbox_queue     = NULL;
+static TaskHandle_t             outbox_task      = NULL;
+static outbox_status_cb_t       outbox_status_cb = NULL;
+static esp_mqtt_client_handle_t outbox_client    = NULL;
+static volatile bool            outbox_connected = false;
+
+// Only touched by the posting task
+static outbox_recent_t outbox_recent[OUTBOX_RECENT] = {0};
+static size_t          outbox_recent_next           = 0;
+
+// Messages awaiting a broker acknowledgement, shared between the publisher task and the MQTT event handler
+static portMUX_TYPE     outbox_pending_lock            = portMUX_INITIALIZER_UNLOCKED;
+static outbox_pending_t outbox_pending[OUTBOX_PENDING] = {0};
+static size_t           outbox_pending_next            = 0;
+
+// Shared like the pending messages, under the same lock
+static outbox_early_ack_t outbox_early_acks[OUTBOX_EARLY_ACKS] = {0};
+static size_t             outbox_early_next                    = 0;
+
+// Only touched by the publisher task
+static uint32_t outbox_sequence = 0;
+
+static uint32_t outbox_hash(char const* topic, char const* payload) {
+    // FNV-1a over topic and payload, with a separator that cannot occur in either
+    uint32_t hash = 2166136261u;
+    for (char const* c = topic; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    hash = (hash ^ 0xFF) * 16777619u;
+    for (char const* c = payload; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash;
+}
+
+static void outbox_report(outbox_status_t status, char const* payload) {
+    if (outbox_status_cb != NULL) {
+        outbox_status_cb(status, payload);
+    }
+}
+
+// Adds the next sequence number and the current time to an event, other payloads are sent as they are
+static char const* outbox_stamp(char const* payload, char* out, size_t size) {
+    event_json_parser_t parser;
+    event_json_event_t  event;
+    event_json_init(&parser, &event);
+    event_json_feed(&parser, payload, strlen(payload));
+    if (event_json_finish(&parser) != EVENT_JSON_DONE) {
+        return payload;
+    }
+
+    event.sequence   = outbox_sequence + 1;
+    event.timestamp  = latency_now_ms();
+    event.fields    |= EVENT_JSON_FIELD_SEQUENCE | EVENT_JSON_FIELD_TIMESTAMP;
+    if (event_json_format(out, size, &event) >= size) {
+        return payload;
+    }
+    return out;
+}
+
+static void outbox_acknowledged(bool delivered, int64_t sent, int64_t acked, char const* payload) {
+    if (delivered) {
+        perf_record(PERF_HIST_PUBLISH_RTT, acked - sent);
+        outbox_report(OUTBOX_STATUS_DELIVERED, payload);
+    } else {
+        outbox_report(OUTBOX_STATUS_FAILED, payload);
+    }
+}
+
+// With the pending lock held
+static bool outbox_take_early_ack(int msg_id, outbox_early_ack_t* out) {
+    TickType_t now = xTaskGetTickCount();
+    for (size_t i = 0; i < OUTBOX_EARLY_ACKS; i++) {
+        outbox_early_ack_t* ack = &outbox_early_acks[i];
+        if (ack->msg_id == msg_id && now - ack->arrived < pdMS_TO_TICKS(OUTBOX_EARLY_ACK_MS)) {
+            *out        = *ack;
+            ack->msg_id = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool outbox_publish(char const* topic, char const* payload) {
+    char        stamped[OUTBOX_PAYLOAD_LENGTH + 48];
+    char const* message = outbox_stamp(payload, stamped, sizeof(stamped));
+    size_t      length  = strlen(message);
+
+    uint8_t sealed[sizeof(stamped) + MESSAGE_CRYPTO_OVERHEAD];
+    if (message_crypto_enabled()) {
+        if (message_crypto_seal(topic, (uint8_t const*)message, length, sealed, sizeof(sealed), &length) != ESP_OK) {
+            return false;
+        }
+    }
+
+    char const* data   = message_crypto_enabled() ? (char const*)sealed : message;
+    int64_t     sent   = perf_now();
+    int         msg_id = esp_mqtt_client_publish(outbox_client, topic, data, length, 1, 0);
+    if (msg_id < 0) {
+        return false;
+    }
+    if (message == stamped) {
+        outbox_sequence++;
+    }
+
+    // The MQTT task can handle the acknowledgement before the publish call even returns
+    outbox_early_ack_t early = {0};
+    taskENTER_CRITICAL(&outbox_pending_lock);
+    bool acked = outbox_take_early_ack(msg_id, &early);
+    if (!acked) {
+        outbox_pending_t* pending = &outbox_pending[outbox_pending_next];
+        outbox_pending_next       = (outbox_pending_next + 1) % OUTBOX_PENDING;
+        pending->msg_id           = msg_id;
+        pending->sent             = sent;
+        strlcpy(pending->payload, payload, sizeof(pending->payload));
+    }
+    taskEXIT_CRITICAL(&outbox_pending_lock);
+
+    outbox_report(OUTBOX_STATUS_SENT, payload);
+    if (acked) {
+        outbox_acknowledged(early.delivered, sent, early.acked, payload);
+    }
+    return true;
+}
+
+static void outbox_store(char const* topic, char const* payload) {
+    if (offline_log_append(topic, payload) != ESP_OK) {
+        outbox_report(OUTBOX_STATUS_FAILED, payload);
+        return;
+    }
+    outbox_report(OUTBOX_STATUS_STORED, payload);
+}
+
+static void outbox_publish_stored(char const* topic, char const* payload, size_t count) {
+    if (!outbox_connected || !outbox_publish(topic, payload)) {
+        // Lost the connection again halfway through the batch
+        offline_log_append(topic, payload);
+    }
+}
+
+static void outbox_publisher_task(void* pvParameters) {
+    outbox_item_t item;
+    while (1) {
+        if (xQueuePeek(outbox_queue, &item, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        if (item.topic[0] == '\0') {
+            // Marker queued on connect: publish everything stored while offline
+            xQueueReceive(outbox_queue, &item, 0);
+            offline_log_flush(outbox_publish_stored);
+            continue;
+        }
+
+        if (!outbox_connected) {
+            xQueueReceive(outbox_queue, &item, 0);
+            outbox_store(item.topic, item.payload);
+            continue;
+        }
+
+        if (!outbox_publish(item.topic, item.payload)) {
+            ESP_LOGW(TAG, "Publish failed, retrying");
+            vTaskDelay(pdMS_TO_TICKS(OUTBOX_RETRY_MS));
+            continue;
+        }
+        xQueueReceive(outbox_queue, &item, 0);
+    }
+}
+
+esp_err_t outbox_init(outbox_status_cb_t status_cb) {
+    outbox_status_cb = status_cb;
+    outbox_queue     = xQueueCreate(OUTBOX_QUEUE_LENGTH, sizeof(outbox_item_t));
+    if (outbox_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Flushing the offline log goes through stdio, which needs the larger stack
+    if (xTaskCreate(outbox_publisher_task, "outbox_task", 6144, NULL, 6, &outbox_task) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Never waits for the network or for storage: while offline the outbox task writes the message to
+// the offline log. Returns false when the message could not be queued.
+bool outbox_post(char const* topic, char const* payload) {
+    uint32_t   hash = outbox_hash(topic, payload);
+    TickType_t now  = xTaskGetTickCount();
+
+    for (size_t i = 0; i < OUTBOX_RECENT; i++) {
+        if (outbox_recent[i].hash == hash && outbox_recent[i].posted != 0 &&
+            now - outbox_recent[i].posted < pdMS_TO_TICKS(OUTBOX_COALESCE_MS)) {
+            outbox_report(OUTBOX_STATUS_COALESCED, payload);
+            return true;
+        }
+    }
+
+    outbox_item_t item;
+    strlcpy(item.topic, topic, sizeof(item.topic));
+    strlcpy(item.payload, payload, sizeof(item.payload));
+    if (xQueueSend(outbox_queue, &item, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Outbox full, dropping \"%s\"", payload);
+        outbox_report(OUTBOX_STATUS_FAILED, payload);
+        return false;
+    }
+    outbox_report(OUTBOX_STATUS_QUEUED, payload);
+
+    outbox_recent[outbox_recent_next] = (outbox_recent_t){hash, now};
+    outbox_recent_next                = (outbox_recent_next + 1) % OUTBOX_RECENT;
+    return true;
+}
+
+void outbox_set_client(esp_mqtt_client_handle_t client, bool connected) {
+    outbox_client    = client;
+    outbox_connected = connected && client != NULL;
+    if (outbox_connected && outbox_task != NULL) {
+        outbox_item_t flush = {0};
+        xQueueSendToFront(outbox_queue, &flush, 0);
+    }
+}
+
+// Without a pending message the acknowledgement may have beaten the publisher task to recording
+// it, so it is kept for the publisher task to find
+static bool outbox_take_pending(int msg_id, bool delivered, char* payload, size_t size, int64_t* sent) {
+    if (msg_id <= 0) {
+        return false;
+    }
+
+    bool found = false;
+    taskENTER_CRITICAL(&outbox_pending_lock);
+    for (size_t i = 0; i < OUTBOX_PENDING; i++) {
+        if (outbox_pending[i].msg_id == msg_id) {
+            strlcpy(payload, outbox_pending[i].payload, size);
+            *sent                    = outbox_pending[i].sent;
+            outbox_pending[i].msg_id = 0;
+            found                    = true;
+            break;
+        }
+    }
+    if (!found) {
+        outbox_early_acks[outbox_early_next] = (outbox_early_ack_t){msg_id, delivered, perf_now(), xTaskGetTickCount()};
+        outbox_early_next                    = (outbox_early_next + 1) % OUTBOX_EARLY_ACKS;
+    }
+    taskEXIT_CRITICAL(&outbox_pending_lock);
+    return found;
+}
+
+void outbox_handle_published(int msg_id) {
+    char    payload[OUTBOX_PAYLOAD_LENGTH];
+    int64_t sent;
+    if (outbox_take_pending(msg_id, true, payload, sizeof(payload), &sent)) {
+        outbox_acknowledged(true, sent, perf_now(), payload);
+    }
+}
+
+void outbox_handle_deleted(int msg_id) {
+    char    payload[OUTBOX_PAYLOAD_LENGTH];
+    int64_t sent;
+    if (outbox_take_pending(msg_id, false, payload, sizeof(payload), &sent)) {
+        outbox_acknowledged(false, sent, perf_now(), payload);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#define OUTBOX_TOPIC_LENGTH   48
+#define OUTBOX_PAYLOAD_LENGTH 192
+
+typedef enum {
+    OUTBOX_STATUS_QUEUED,
+    OUTBOX_STATUS_STORED,     // Offline, kept in the persistent log until the next connection
+    OUTBOX_STATUS_COALESCED,  // Dropped as a repeat of a recent identical message
+    OUTBOX_STATUS_SENT,
+    OUTBOX_STATUS_DELIVERED,  // Acknowledged by the broker
+    OUTBOX_STATUS_FAILED,
+} outbox_status_t;
+
+typedef void (*outbox_status_cb_t)(outbox_status_t status, char const* payload);
+
+esp_err_t outbox_init(outbox_status_cb_t status_cb);
+bool      outbox_post(char const* topic, char const* payload);
+void      outbox_set_client(esp_mqtt_client_handle_t client, bool connected);
+void      outbox_handle_published(int msg_id);
+void      outbox_handle_deleted(int msg_id);
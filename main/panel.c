@@ -0,0 +1,299 @@
+#include "panel.h"
+#include <inttypes.h>
+#include <string.h>
+#include "bsp/display.h"
+#include "damage.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_lcd_panel_io.h"
+#include "esp_lcd_panel_ops.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "pax_gfx.h"
+#include "perf.h"
+#include "sdkconfig.h"
+
+#if defined(CONFIG_BSP_TARGET_TANMATSU) || defined(CONFIG_BSP_TARGET_KONSOOL) || \
+    defined(CONFIG_BSP_TARGET_HACKERHOTEL_2026) || defined(CONFIG_BSP_TARGET_ESP32_P4_FUNCTION_EV_BOARD)
+#define DSI_PANEL
+#endif
+
+#ifdef DSI_PANEL
+#include "esp_lcd_mipi_dsi.h"
+#endif
+
+// Double-buffered framebuffer. The render task draws a frame into the back buffer and queues the
+// regions it changed; a flush task transfers them to the panel while the render task continues
+// with the other buffer. A buffer is handed back for drawing once the panel signals that the last
+// transfer out of it has completed. Regions are given in the oriented (drawing) coordinate space
+// and are transformed into raw panel coordinates here.
+
+#define PANEL_BUFFERS              2
+#define PANEL_TRANSFER_TIMEOUT_MS  100
+#define PANEL_STATS_INTERVAL_US    (10 * 1000 * 1000)
+
+typedef struct {
+    size_t        count;
+    damage_rect_t rects[DAMAGE_MAX_RECTS];  // Raw panel coordinates
+    perf_frame_t  perf;
+} panel_frame_t;
+
+static char const TAG[] = "panel";
+
+static esp_lcd_panel_handle_t panel_handle      = NULL;
+static int                    panel_h_res       = 0;
+static int                    panel_v_res       = 0;
+static pax_orientation_t      panel_orientation = PAX_O_UPRIGHT;
+static size_t                 panel_bpp         = 2;
+static uint8_t*               panel_staging     = NULL;
+
+static pax_buf_t         panel_buffers[PANEL_BUFFERS] = {0};
+static panel_frame_t     panel_frames[PANEL_BUFFERS]  = {0};
+static SemaphoreHandle_t panel_buffer_free[PANEL_BUFFERS];
+static size_t            panel_buffer_count = 0;
+static size_t            panel_back         = 0;
+static bool              panel_back_owned   = false;
+static bool              panel_back_synced  = true;
+
+static QueueHandle_t     panel_flush_queue    = NULL;
+static SemaphoreHandle_t panel_transfer_done  = NULL;
+static bool              panel_transfer_async = false;
+
+// Frame cost counter
+static uint64_t stats_pixels   = 0;
+static uint32_t stats_flushes  = 0;
+static uint32_t stats_frames   = 0;
+static int64_t  stats_start_us = 0;
+
+#ifdef DSI_PANEL
+static bool IRAM_ATTR panel_transfer_done_cb(esp_lcd_panel_handle_t panel, esp_lcd_dpi_panel_event_data_t* edata,
+                                             void* user_ctx) {
+#else
+static bool IRAM_ATTR panel_transfer_done_cb(esp_lcd_panel_io_handle_t panel_io,
+                                             esp_lcd_panel_io_event_data_t* edata, void* user_ctx) {
+#endif
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(panel_transfer_done, &woken);
+    return woken == pdTRUE;
+}
+
+static esp_err_t panel_register_transfer_done(void) {
+#ifdef DSI_PANEL
+    esp_lcd_dpi_panel_event_callbacks_t callbacks = {
+        .on_color_trans_done = panel_transfer_done_cb,
+    };
+    return esp_lcd_dpi_panel_register_event_callbacks(panel_handle, &callbacks, NULL);
+#else
+    esp_lcd_panel_io_handle_t panel_io = NULL;
+    esp_err_t                 res      = bsp_display_get_panel_io(&panel_io);
+    if (res != ESP_OK) {
+        return res;
+    }
+    esp_lcd_panel_io_callbacks_t callbacks = {
+        .on_color_trans_done = panel_transfer_done_cb,
+    };
+    return esp_lcd_panel_io_register_event_callbacks(panel_io, &callbacks, NULL);
+#endif
+}
+
+static void panel_flush_task(void* pvParameters) {
+    size_t index;
+    while (1) {
+        if (xQueueReceive(panel_flush_queue, &index, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        panel_frame_t* frame  = &panel_frames[index];
+        uint8_t const* pixels = pax_buf_get_pixels(&panel_buffers[index]);
+        size_t         stride = panel_h_res * panel_bpp;
+        int64_t        start  = perf_now();
+
+        for (size_t i = 0; i < frame->count; i++) {
+            damage_rect_t rect = frame->rects[i];
+            void const*   src  = pixels + rect.y * stride;
+
+            if (rect.w != panel_h_res) {
+                // Pack the rows of the region so the panel driver sees a contiguous bitmap
+                size_t row = rect.w * panel_bpp;
+                for (int line = 0; line < rect.h; line++) {
+                    memcpy(panel_staging + line * row, pixels + (rect.y + line) * stride + rect.x * panel_bpp, row);
+                }
+                src = panel_staging;
+            }
+
+            esp_err_t res =
+                esp_lcd_panel_draw_bitmap(panel_handle, rect.x, rect.y, rect.x + rect.w, rect.y + rect.h, src);
+            if (res == ESP_OK && panel_transfer_async) {
+                if (xSemaphoreTake(panel_transfer_done, pdMS_TO_TICKS(PANEL_TRANSFER_TIMEOUT_MS)) != pdTRUE) {
+                    ESP_LOGW(TAG, "Timeout waiting for panel transfer");
+                }
+            } else if (res != ESP_OK) {
+                ESP_LOGE(TAG, "Panel transfer failed (%s)", esp_err_to_name(res));
+            }
+        }
+
+        perf_record(PERF_HIST_BLIT, perf_now() - start);
+        perf_frame_presented(&frame->perf);
+        xSemaphoreGive(panel_buffer_free[index]);
+    }
+}
+
+esp_err_t panel_init(esp_lcd_panel_handle_t panel, size_t h_res, size_t v_res, pax_buf_type_t format,
+                     pax_orientation_t orientation, bool reversed) {
+    panel_handle      = panel;
+    panel_h_res       = h_res;
+    panel_v_res       = v_res;
+    panel_orientation = orientation;
+    panel_bpp         = (format == PAX_BUF_16_565RGB) ? 2 : 3;
+    panel_geometry_init(h_res, v_res, orientation);
+
+    size_t size = h_res * v_res * panel_bpp;
+    for (size_t i = 0; i < PANEL_BUFFERS; i++) {
+        void* pixels = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+        if (pixels == NULL) {
+            break;
+        }
+        pax_buf_init(&panel_buffers[i], pixels, h_res, v_res, format);
+        pax_buf_reversed(&panel_buffers[i], reversed);
+        pax_buf_set_orientation(&panel_buffers[i], orientation);
+        panel_buffer_free[i] = xSemaphoreCreateBinary();
+        xSemaphoreGive(panel_buffer_free[i]);
+        panel_buffer_count++;
+    }
+    if (panel_buffer_count == 0) {
+        ESP_LOGE(TAG, "Failed to allocate a framebuffer");
+        return ESP_ERR_NO_MEM;
+    }
+    if (panel_buffer_count < PANEL_BUFFERS) {
+        ESP_LOGW(TAG, "Running single-buffered");
+    }
+
+    // Regions narrower than a full row need to be packed into a contiguous buffer
+    panel_staging = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (panel_staging == NULL) {
+        ESP_LOGW(TAG, "No staging buffer, partial updates will be widened to full rows");
+    }
+
+    panel_transfer_done  = xSemaphoreCreateBinary();
+    panel_transfer_async = panel_register_transfer_done() == ESP_OK;
+    if (!panel_transfer_async) {
+        ESP_LOGW(TAG, "No transfer-done callback, assuming synchronous transfers");
+    }
+
+    panel_flush_queue = xQueueCreate(1, sizeof(size_t));
+    if (xTaskCreate(panel_flush_task, "panel_flush", 4096, NULL, 11, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    stats_start_us = esp_timer_get_time();
+    return ESP_OK;
+}
+
+// Returns the buffer to draw the next frame into, waiting until the panel is done reading from it
+pax_buf_t* panel_begin_frame(void) {
+    if (panel_buffer_count == 0) {
+        return NULL;
+    }
+
+    if (!panel_back_owned) {
+        xSemaphoreTake(panel_buffer_free[panel_back], portMAX_DELAY);
+        panel_back_owned = true;
+        // The regions transferred out of this buffer last time are no longer needed
+        panel_frames[panel_back].count = 0;
+    }
+
+    if (!panel_back_synced) {
+        // Bring the back buffer up to date with the regions changed in the previous frame
+        size_t         front  = (panel_back + 1) % panel_buffer_count;
+        uint8_t const* src    = pax_buf_get_pixels(&panel_buffers[front]);
+        uint8_t*       dst    = pax_buf_get_pixels_rw(&panel_buffers[panel_back]);
+        size_t         stride = panel_h_res * panel_bpp;
+        for (size_t i = 0; i < panel_frames[front].count; i++) {
+            damage_rect_t* rect = &panel_frames[front].rects[i];
+            for (int line = 0; line < rect->h; line++) {
+                size_t offset = (rect->y + line) * stride + rect->x * panel_bpp;
+                memcpy(dst + offset, src + offset, rect->w * panel_bpp);
+            }
+        }
+        panel_back_synced = true;
+    }
+
+    return &panel_buffers[panel_back];
+}
+
+esp_err_t panel_flush(int x, int y, int w, int h) {
+    if (panel_handle == NULL || !panel_back_owned) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!panel_to_raw(&x, &y, &w, &h)) {
+        return ESP_OK;
+    }
+
+    if (panel_staging == NULL) {
+        x = 0;
+        w = panel_h_res;
+    }
+
+    panel_frame_t* frame = &panel_frames[panel_back];
+    if (frame->count >= DAMAGE_MAX_RECTS) {
+        // Out of slots, grow the last region to cover this one as well
+        damage_rect_t* last = &frame->rects[DAMAGE_MAX_RECTS - 1];
+        int            x1   = (last->x + last->w) > (x + w) ? (last->x + last->w) : (x + w);
+        int            y1   = (last->y + last->h) > (y + h) ? (last->y + last->h) : (y + h);
+        last->x             = last->x < x ? last->x : x;
+        last->y             = last->y < y ? last->y : y;
+        last->w             = x1 - last->x;
+        last->h             = y1 - last->y;
+        return ESP_OK;
+    }
+    frame->rects[frame->count++] = (damage_rect_t){x, y, w, h};
+    return ESP_OK;
+}
+
+esp_err_t panel_flush_all(void) {
+    if (panel_orientation == PAX_O_ROT_CCW || panel_orientation == PAX_O_ROT_CW) {
+        return panel_flush(0, 0, panel_v_res, panel_h_res);
+    }
+    return panel_flush(0, 0, panel_h_res, panel_v_res);
+}
+
+// Hands the regions queued for the current frame to the flush task and swaps buffers
+void panel_end_frame(void) {
+    stats_frames++;
+
+    panel_frame_t* frame = &panel_frames[panel_back];
+    if (panel_back_owned && frame->count > 0) {
+        for (size_t i = 0; i < frame->count; i++) {
+            stats_pixels += frame->rects[i].w * frame->rects[i].h;
+        }
+        stats_flushes += frame->count;
+        perf_frame_submit(&frame->perf);
+
+        size_t index = panel_back;
+        xQueueSend(panel_flush_queue, &index, portMAX_DELAY);
+
+        panel_back        = (panel_back + 1) % panel_buffer_count;
+        panel_back_owned  = false;
+        panel_back_synced = panel_buffer_count == 1;
+    }
+
+    int64_t elapsed = esp_timer_get_time() - stats_start_us;
+    if (elapsed < PANEL_STATS_INTERVAL_US) {
+        return;
+    }
+
+    // Compare against what unconditional full-frame redraws would have pushed in the same number of frames
+    uint64_t full = (uint64_t)stats_frames * panel_h_res * panel_v_res;
+    ESP_LOGI(TAG, "Pushed %" PRIu64 " px/s in %" PRIu32 " transfers over %" PRIu32 " frames (full redraw: %" PRIu64
+             " px/s)",
+             stats_pixels * 1000000 / elapsed, stats_flushes, stats_frames, full * 1000000 / elapsed);
+
+    stats_pixels   = 0;
+    stats_flushes  = 0;
+    stats_frames   = 0;
+    stats_start_us = esp_timer_get_time();
+}
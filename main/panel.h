@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_lcd_types.h"
+#include "pax_types.h"
+
+esp_err_t  panel_init(esp_lcd_panel_handle_t panel, size_t h_res, size_t v_res, pax_buf_type_t format,
+                      pax_orientation_t orientation, bool reversed);
+void       panel_geometry_init(size_t h_res, size_t v_res, pax_orientation_t orientation);
+pax_buf_t* panel_begin_frame(void);
+bool       panel_to_raw(int* x, int* y, int* w, int* h);
+esp_err_t  panel_flush(int x, int y, int w, int h);
+esp_err_t  panel_flush_all(void);
+void       panel_end_frame(void);
@@ -0,0 +1,52 @@
+#include <stddef.h>
+#include "panel.h"
+
+// Panel geometry shared by the panel driver and its host stand-in
+
+static int               panel_h_res       = 0;
+static int               panel_v_res       = 0;
+static pax_orientation_t panel_orientation = PAX_O_UPRIGHT;
+
+void panel_geometry_init(size_t h_res, size_t v_res, pax_orientation_t orientation) {
+    panel_h_res       = h_res;
+    panel_v_res       = v_res;
+    panel_orientation = orientation;
+}
+
+// Convert a rectangle from oriented coordinates into raw panel coordinates, clipped to the panel
+bool panel_to_raw(int* x, int* y, int* w, int* h) {
+    int ox = *x, oy = *y, ow = *w, oh = *h;
+    switch (panel_orientation) {
+        case PAX_O_ROT_CCW:
+            *x = oy;
+            *y = panel_v_res - (ox + ow);
+            *w = oh;
+            *h = ow;
+            break;
+        case PAX_O_ROT_HALF:
+            *x = panel_h_res - (ox + ow);
+            *y = panel_v_res - (oy + oh);
+            break;
+        case PAX_O_ROT_CW:
+            *x = panel_h_res - (oy + oh);
+            *y = ox;
+            *w = oh;
+            *h = ow;
+            break;
+        case PAX_O_UPRIGHT:
+        default:
+            break;
+    }
+
+    if (*x < 0) {
+        *w += *x;
+        *x  = 0;
+    }
+    if (*y < 0) {
+        *h += *y;
+        *y  = 0;
+    }
+    if (*x + *w > panel_h_res) *w = panel_h_res - *x;
+    if (*y + *h > panel_v_res) *h = panel_v_res - *y;
+    return *w > 0 && *h > 0;
+}
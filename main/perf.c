@@ -0,0 +1,190 @@
+#include "perf.h"
+
+#ifdef CONFIG_NOTIFIER_PERF
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "power.h"
+
+// Hot-path counters and latency histograms. Recording is a few instructions under a spinlock;
+// a low priority task periodically turns the interval's numbers into a compact JSON snapshot and
+// publishes it next to the event topic, then starts a new interval.
+
+#define PERF_BUCKETS 24  // Bucket i holds durations below 2^i us, the last one everything longer
+
+typedef struct {
+    uint32_t buckets[PERF_BUCKETS];
+    uint32_t count;
+    uint64_t sum;
+    uint32_t max;
+} perf_histogram_t;
+
+static char const TAG[] = "perf";
+
+static char const* const hist_names[PERF_HIST_COUNT] = {
+    "render", "blit", "rx", "input", "rtt", "crypto", "tls_full", "tls_resumed",
+};
+static char const* const watched_tasks[] = {"led_task", "render_task", "mqtt_task", "power_task"};
+
+static portMUX_TYPE     perf_lock                      = portMUX_INITIALIZER_UNLOCKED;
+static perf_histogram_t histograms[PERF_HIST_COUNT]    = {0};
+static uint32_t         counters[PERF_COUNTER_COUNT]   = {0};
+static int64_t          pending_marks[PERF_MARK_COUNT] = {0};
+
+static esp_mqtt_client_handle_t perf_client    = NULL;
+static volatile bool            perf_connected = false;
+
+static size_t bucket_for(uint32_t us) {
+    size_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    return bucket < PERF_BUCKETS ? bucket : PERF_BUCKETS - 1;
+}
+
+void perf_record(perf_hist_t hist, int64_t us) {
+    uint32_t value = us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : us;
+    size_t   slot  = bucket_for(value);
+
+    taskENTER_CRITICAL(&perf_lock);
+    perf_histogram_t* histogram = &histograms[hist];
+    histogram->buckets[slot]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) histogram->max = value;
+    taskEXIT_CRITICAL(&perf_lock);
+}
+
+void perf_count(perf_counter_t counter) {
+    taskENTER_CRITICAL(&perf_lock);
+    counters[counter]++;
+    taskEXIT_CRITICAL(&perf_lock);
+}
+
+// Keeps the oldest unpresented event of each kind, the latency is measured from there
+void perf_mark(perf_mark_t mark) {
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&perf_lock);
+    if (pending_marks[mark] == 0) pending_marks[mark] = now;
+    taskEXIT_CRITICAL(&perf_lock);
+}
+
+// Called when a frame is handed to the panel: the events so far are shown by this frame
+void perf_frame_submit(perf_frame_t* frame) {
+    taskENTER_CRITICAL(&perf_lock);
+    memcpy(frame->marks, pending_marks, sizeof(frame->marks));
+    memset(pending_marks, 0, sizeof(pending_marks));
+    counters[PERF_COUNTER_FRAMES]++;
+    taskEXIT_CRITICAL(&perf_lock);
+}
+
+void perf_frame_presented(perf_frame_t* frame) {
+    int64_t now = esp_timer_get_time();
+    if (frame->marks[PERF_MARK_RX] != 0) {
+        perf_record(PERF_HIST_RX_TO_DISPLAY, now - frame->marks[PERF_MARK_RX]);
+    }
+    if (frame->marks[PERF_MARK_INPUT] != 0) {
+        perf_record(PERF_HIST_INPUT_TO_DISPLAY, now - frame->marks[PERF_MARK_INPUT]);
+    }
+    memset(frame->marks, 0, sizeof(frame->marks));
+}
+
+void perf_set_client(esp_mqtt_client_handle_t client, bool connected) {
+    perf_client    = client;
+    perf_connected = connected && client != NULL;
+}
+
+// Upper bound of the bucket containing the given fraction (per mille) of the samples
+static uint32_t percentile(perf_histogram_t const* histogram, uint32_t per_mille) {
+    uint32_t target = ((uint64_t)histogram->count * per_mille + 999) / 1000;
+    uint32_t seen   = 0;
+    for (size_t i = 0; i < PERF_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target && seen > 0) {
+            return i == PERF_BUCKETS - 1 ? histogram->max : (1u << i) - 1;
+        }
+    }
+    return histogram->max;
+}
+
+static size_t format_snapshot(char* out, size_t size, perf_histogram_t const* snapshot, uint32_t const* counts) {
+    uint8_t mac[6] = {0};
+    esp_efuse_mac_get_default(mac);
+
+    size_t length = snprintf(out, size, "{\"id\":\"%02x%02x%02x\",\"up\":%" PRId64 ",\"frames\":%lu,\"wifi\":%lu",
+                             mac[3], mac[4], mac[5], esp_timer_get_time() / 1000000,
+                             (unsigned long)counts[PERF_COUNTER_FRAMES],
+                             (unsigned long)counts[PERF_COUNTER_WIFI_RECONNECTS]);
+
+    // Lowest free internal RAM and PSRAM since boot
+    if (length < size) {
+        length += snprintf(out + length, size - length, ",\"heap\":%u,\"psram\":%u",
+                           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+                           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+    }
+
+    // Per histogram: [count, mean, p50, p95, max] in microseconds
+    for (size_t i = 0; i < PERF_HIST_COUNT && length < size; i++) {
+        perf_histogram_t const* histogram = &snapshot[i];
+        uint32_t                mean      = histogram->count ? histogram->sum / histogram->count : 0;
+        length += snprintf(out + length, size - length, ",\"%s\":[%lu,%lu,%lu,%lu,%lu]", hist_names[i],
+                           (unsigned long)histogram->count, (unsigned long)mean,
+                           (unsigned long)percentile(histogram, 500), (unsigned long)percentile(histogram, 950),
+                           (unsigned long)histogram->max);
+    }
+
+    // Seconds spent active, dimmed and in standby since boot, and the estimated average current in mA
+    power_stats_t power;
+    power_get_stats(&power);
+    if (length < size) {
+        length += snprintf(out + length, size - length, ",\"power\":[%" PRId64 ",%" PRId64 ",%" PRId64 ",%lu]",
+                           power.time_us[POWER_MODE_ACTIVE] / 1000000, power.time_us[POWER_MODE_DIMMED] / 1000000,
+                           power.time_us[POWER_MODE_STANDBY] / 1000000, (unsigned long)power.average_ma);
+    }
+
+    // Unused stack in bytes, -1 for tasks that are not running
+    for (size_t i = 0; i < sizeof(watched_tasks) / sizeof(watched_tasks[0]) && length < size; i++) {
+        TaskHandle_t task  = xTaskGetHandle(watched_tasks[i]);
+        long         space = task != NULL ? (long)uxTaskGetStackHighWaterMark(task) : -1;
+        length += snprintf(out + length, size - length, "%s%ld", i == 0 ? ",\"stack\":[" : ",", space);
+    }
+    if (length < size) {
+        length += snprintf(out + length, size - length, "]}");
+    }
+    return length < size ? length : size - 1;
+}
+
+static void perf_task(void* pvParameters) {
+    static perf_histogram_t snapshot[PERF_HIST_COUNT];
+    static char             payload[768];
+    uint32_t                counts[PERF_COUNTER_COUNT];
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_NOTIFIER_PERF_INTERVAL_S * 1000));
+
+        taskENTER_CRITICAL(&perf_lock);
+        memcpy(snapshot, histograms, sizeof(snapshot));
+        memcpy(counts, counters, sizeof(counts));
+        memset(histograms, 0, sizeof(histograms));
+        memset(counters, 0, sizeof(counters));
+        taskEXIT_CRITICAL(&perf_lock);
+
+        size_t length = format_snapshot(payload, sizeof(payload), snapshot, counts);
+        ESP_LOGI(TAG, "%s", payload);
+        if (perf_connected) {
+            esp_mqtt_client_publish(perf_client, CONFIG_NOTIFIER_PERF_TOPIC, payload, length, 0, 0);
+        }
+    }
+}
+
+esp_err_t perf_init(void) {
+    if (xTaskCreate(perf_task, "perf_task", 3072, NULL, 2, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+#endif
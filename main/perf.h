@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_NOTIFIER_PERF
+#include "esp_timer.h"
+#include "mqtt_client.h"
+#endif
+
+typedef enum {
+    PERF_HIST_RENDER,            // Drawing one frame
+    PERF_HIST_BLIT,              // Transferring one frame to the panel
+    PERF_HIST_RX_TO_DISPLAY,     // MQTT message received until shown
+    PERF_HIST_INPUT_TO_DISPLAY,  // Key press until its effect is shown
+    PERF_HIST_PUBLISH_RTT,       // Publish until acknowledged by the broker
+    PERF_HIST_CRYPTO,            // Encrypting or decrypting one message
+    PERF_HIST_TLS_FULL,          // TLS handshake without a session to resume
+    PERF_HIST_TLS_RESUMED,       // TLS handshake resuming the previous session
+    PERF_HIST_COUNT
+} perf_hist_t;
+
+typedef enum {
+    PERF_COUNTER_FRAMES,
+    PERF_COUNTER_WIFI_RECONNECTS,
+    PERF_COUNTER_COUNT
+} perf_counter_t;
+
+// Events waiting for the next frame to reach the panel
+typedef enum {
+    PERF_MARK_RX,
+    PERF_MARK_INPUT,
+    PERF_MARK_COUNT
+} perf_mark_t;
+
+// Marks carried by a frame from submission until its transfer completes
+typedef struct {
+    int64_t marks[PERF_MARK_COUNT];
+} perf_frame_t;
+
+#ifdef CONFIG_NOTIFIER_PERF
+
+static inline int64_t perf_now(void) {
+    return esp_timer_get_time();
+}
+
+esp_err_t perf_init(void);
+void      perf_set_client(esp_mqtt_client_handle_t client, bool connected);
+void      perf_record(perf_hist_t hist, int64_t us);
+void      perf_count(perf_counter_t counter);
+void      perf_mark(perf_mark_t mark);
+void      perf_frame_submit(perf_frame_t* frame);
+void      perf_frame_presented(perf_frame_t* frame);
+
+#else
+
+// Disabled: every hook is an empty inline so the call sites cost nothing
+static inline int64_t perf_now(void) {
+    return 0;
+}
+
+static inline esp_err_t perf_init(void) {
+    return ESP_OK;
+}
+
+#define perf_set_client(client, connected) ((void)(client), (void)(connected))
+
+static inline void perf_record(perf_hist_t hist, int64_t us) {
+}
+
+static inline void perf_count(perf_counter_t counter) {
+}
+
+static inline void perf_mark(perf_mark_t mark) {
+}
+
+static inline void perf_frame_submit(perf_frame_t* frame) {
+}
+
+static inline void perf_frame_presented(perf_frame_t* frame) {
+}
+
+#endif
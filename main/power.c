@@ -0,0 +1,197 @@
+#include "power.h"
+#include <string.h>
+#include "bsp/display.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "render_scheduler.h"
+#include "sdkconfig.h"
+#include "ui.h"
+
+// Steps the badge down while nobody uses it: after a while without input or incoming messages the
+// backlight dims, the clock drops to minute resolution and the CPU is allowed to scale down (and,
+// when configured, to light sleep in tickless idle); later the backlight goes off and nothing is
+// rendered. Any activity brings everything back at once. Time spent in every mode is weighed with
+// the configured current estimates to report the average draw and the expected runtime.
+
+#define POWER_EVENT_ACTIVITY (1 << 0)
+
+typedef struct {
+    uint8_t  brightness;  // Backlight in percent
+    uint32_t clock_s;     // Clock update period, 0 to stop updating
+    uint32_t battery_ms;  // Battery poll period
+    uint32_t current_ma;  // Estimated average draw
+} power_profile_t;
+
+static char const TAG[] = "power";
+
+static power_profile_t const profiles[POWER_MODE_COUNT] = {
+    [POWER_MODE_ACTIVE]  = {100, 1, 5000, CONFIG_NOTIFIER_POWER_ACTIVE_MA},
+    [POWER_MODE_DIMMED]  = {CONFIG_NOTIFIER_POWER_DIM_BRIGHTNESS, 60, 30000, CONFIG_NOTIFIER_POWER_DIMMED_MA},
+    [POWER_MODE_STANDBY] = {0, 0, 120000, CONFIG_NOTIFIER_POWER_STANDBY_MA},
+};
+
+static char const* const mode_names[POWER_MODE_COUNT] = {"active", "dimmed", "standby"};
+
+static TaskHandle_t          power_task_handle = NULL;
+static power_mode_cb_t       power_mode_cb     = NULL;
+static volatile power_mode_t power_mode        = POWER_MODE_ACTIVE;
+static portMUX_TYPE          power_lock        = portMUX_INITIALIZER_UNLOCKED;
+static int64_t               mode_time_us[POWER_MODE_COUNT] = {0};
+static int64_t               mode_since_us                  = 0;
+
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpu_lock   = NULL;
+static esp_pm_lock_handle_t sleep_lock = NULL;
+#endif
+
+static void apply_locks(power_mode_t mode) {
+#ifdef CONFIG_PM_ENABLE
+    // Active holds the CPU at full speed, the idle modes let the power management driver scale down
+    static bool cpu_held   = false;
+    static bool sleep_held = false;
+    bool        want_cpu   = mode == POWER_MODE_ACTIVE;
+#ifdef CONFIG_NOTIFIER_POWER_LIGHT_SLEEP
+    bool want_sleep_lock = mode == POWER_MODE_ACTIVE;
+#else
+    bool want_sleep_lock = true;
+#endif
+    if (want_cpu != cpu_held) {
+        want_cpu ? esp_pm_lock_acquire(cpu_lock) : esp_pm_lock_release(cpu_lock);
+        cpu_held = want_cpu;
+    }
+    if (want_sleep_lock != sleep_held) {
+        want_sleep_lock ? esp_pm_lock_acquire(sleep_lock) : esp_pm_lock_release(sleep_lock);
+        sleep_held = want_sleep_lock;
+    }
+#else
+    (void)mode;
+#endif
+}
+
+static void set_mode(power_mode_t mode) {
+    if (mode == power_mode) {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&power_lock);
+    mode_time_us[power_mode] += now - mode_since_us;
+    mode_since_us             = now;
+    power_mode                = mode;
+    taskEXIT_CRITICAL(&power_lock);
+
+    power_profile_t const* profile = &profiles[mode];
+    apply_locks(mode);
+    bsp_display_set_backlight_brightness(profile->brightness);
+    ui_set_clock_seconds(profile->clock_s == 1);
+    render_scheduler_set_clock_period(profile->clock_s);
+
+    power_stats_t stats;
+    power_get_stats(&stats);
+    ESP_LOGI(TAG, "Mode %s, estimated average %lu mA, %lu h %lu min on a full battery", mode_names[mode],
+             (unsigned long)stats.average_ma, (unsigned long)stats.runtime_min / 60,
+             (unsigned long)stats.runtime_min % 60);
+
+    if (power_mode_cb != NULL) {
+        power_mode_cb(mode);
+    }
+}
+
+static void power_task(void* pvParameters) {
+    int64_t last_activity = esp_timer_get_time();
+
+    while (1) {
+        // Sleep until the next step down, or until something happens
+        int64_t step_us = power_mode == POWER_MODE_ACTIVE ? CONFIG_NOTIFIER_POWER_DIM_S * 1000000LL
+                                                          : CONFIG_NOTIFIER_POWER_STANDBY_S * 1000000LL;
+        int64_t    remaining = last_activity + step_us - esp_timer_get_time();
+        TickType_t timeout   = power_mode == POWER_MODE_STANDBY ? portMAX_DELAY
+                               : remaining > 0                  ? pdMS_TO_TICKS(remaining / 1000) + 1
+                                                                : 0;
+
+        uint32_t events = 0;
+        if (xTaskNotifyWait(0, UINT32_MAX, &events, timeout) == pdTRUE && (events & POWER_EVENT_ACTIVITY)) {
+            last_activity = esp_timer_get_time();
+            set_mode(POWER_MODE_ACTIVE);
+            continue;
+        }
+
+        int64_t idle_us = esp_timer_get_time() - last_activity;
+        if (idle_us >= CONFIG_NOTIFIER_POWER_STANDBY_S * 1000000LL) {
+            set_mode(POWER_MODE_STANDBY);
+        } else if (idle_us >= CONFIG_NOTIFIER_POWER_DIM_S * 1000000LL) {
+            set_mode(POWER_MODE_DIMMED);
+        }
+    }
+}
+
+esp_err_t power_init(power_mode_cb_t mode_cb) {
+    power_mode_cb = mode_cb;
+    mode_since_us = esp_timer_get_time();
+
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+#ifdef CONFIG_NOTIFIER_POWER_LIGHT_SLEEP
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t res = esp_pm_configure(&config);
+    if (res == ESP_OK) {
+        res = esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "power_cpu", &cpu_lock);
+    }
+    if (res == ESP_OK) {
+        res = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "power_sleep", &sleep_lock);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up power management: %s", esp_err_to_name(res));
+        return res;
+    }
+    apply_locks(POWER_MODE_ACTIVE);
+#endif
+
+    if (xTaskCreate(power_task, "power_task", 3072, NULL, 4, &power_task_handle) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+// Input or an incoming message, safe to call from any task
+void power_activity(void) {
+    if (power_task_handle != NULL) {
+        xTaskNotify(power_task_handle, POWER_EVENT_ACTIVITY, eSetBits);
+    }
+}
+
+power_mode_t power_get_mode(void) {
+    return power_mode;
+}
+
+uint32_t power_battery_interval_ms(void) {
+    return profiles[power_mode].battery_ms;
+}
+
+void power_get_stats(power_stats_t* stats) {
+    int64_t now = esp_timer_get_time();
+    taskENTER_CRITICAL(&power_lock);
+    memcpy(stats->time_us, mode_time_us, sizeof(stats->time_us));
+    stats->time_us[power_mode] += now - mode_since_us;
+    taskEXIT_CRITICAL(&power_lock);
+
+    int64_t total_us  = 0;
+    int64_t charge_us = 0;  // mA * us
+    for (size_t i = 0; i < POWER_MODE_COUNT; i++) {
+        total_us  += stats->time_us[i];
+        charge_us += stats->time_us[i] * profiles[i].current_ma;
+    }
+    stats->average_ma  = total_us > 0 ? charge_us / total_us : profiles[POWER_MODE_ACTIVE].current_ma;
+    stats->runtime_min = stats->average_ma > 0 ? CONFIG_NOTIFIER_POWER_BATTERY_MAH * 60 / stats->average_ma : 0;
+}
+
+char const* power_mode_name(power_mode_t mode) {
+    return mode < POWER_MODE_COUNT ? mode_names[mode] : "unknown";
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    POWER_MODE_ACTIVE,   // Full brightness, full frame rate, CPU at full speed
+    POWER_MODE_DIMMED,   // Backlight dimmed, clock at minute resolution, CPU frequency scaled down
+    POWER_MODE_STANDBY,  // Backlight off, nothing rendered until the next activity
+    POWER_MODE_COUNT,
+} power_mode_t;
+
+typedef struct {
+    int64_t  time_us[POWER_MODE_COUNT];  // Time spent in every mode since boot
+    uint32_t average_ma;                 // Estimated average current over that time
+    uint32_t runtime_min;                // Expected runtime on a full battery at that average
+} power_stats_t;
+
+// Called from the power task after the mode changed
+typedef void (*power_mode_cb_t)(power_mode_t mode);
+
+esp_err_t    power_init(power_mode_cb_t mode_cb);
+void         power_activity(void);
+power_mode_t power_get_mode(void);
+uint32_t     power_battery_interval_ms(void);
+void         power_get_stats(power_stats_t* stats);
+char const*  power_mode_name(power_mode_t mode);
@@ -0,0 +1,54 @@
+#include "render_scheduler.h"
+#include <stdint.h>
+#include <sys/time.h>
+
+// Wakes the render task only when something changed. Producers post a dirty event through a task
+// notification; bursts of posts that arrive while a frame is pending are folded into one frame.
+// While the clock is shown the task also wakes right after every wall-clock boundary of the clock
+// period: every second normally, every minute or not at all when the power manager slows it down.
+
+#define RENDER_EVENT_DIRTY    (1 << 0)
+#define RENDER_COALESCE_TICKS 1
+
+static TaskHandle_t      render_task_handle = NULL;
+static volatile bool     clock_enabled      = false;
+static volatile uint32_t clock_period_s     = 1;
+
+void render_scheduler_init(TaskHandle_t task) {
+    render_task_handle = task;
+}
+
+void render_scheduler_post(void) {
+    if (render_task_handle != NULL) {
+        xTaskNotify(render_task_handle, RENDER_EVENT_DIRTY, eSetBits);
+    }
+}
+
+void render_scheduler_set_clock(bool enabled) {
+    clock_enabled = enabled;
+    render_scheduler_post();
+}
+
+void render_scheduler_set_clock_period(uint32_t seconds) {
+    clock_period_s = seconds;
+    render_scheduler_post();
+}
+
+static TickType_t ticks_until_next_boundary(uint32_t period_s) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint32_t remaining_ms = period_s * 1000 - (now.tv_sec % period_s) * 1000 - now.tv_usec / 1000;
+    // Round up so the wake-up never lands just before the boundary
+    return pdMS_TO_TICKS(remaining_ms) + 1;
+}
+
+void render_scheduler_wait(void) {
+    uint32_t   period  = clock_period_s;
+    TickType_t timeout = clock_enabled && period > 0 ? ticks_until_next_boundary(period) : portMAX_DELAY;
+    uint32_t   events  = 0;
+    if (xTaskNotifyWait(0, UINT32_MAX, &events, timeout) == pdTRUE) {
+        // Give the rest of a burst the chance to arrive, then drain it
+        vTaskDelay(RENDER_COALESCE_TICKS);
+        xTaskNotifyWait(0, UINT32_MAX, &events, 0);
+    }
+}
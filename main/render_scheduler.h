@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+void render_scheduler_init(TaskHandle_t task);
+void render_scheduler_post(void);
+void render_scheduler_set_clock(bool enabled);
+void render_scheduler_set_clock_period(uint32_t seconds);
+void render_scheduler_wait(void);
@@ -0,0 +1,147 @@
+#include "rx_filter.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+// Decides whether a received message gets to the screen and the LEDs. QoS 1 delivers a message
+// again when an acknowledgement got lost, and the badge is subscribed to the topic it publishes
+// to, so it hears its own events back; both are dropped. A sender that publishes faster than the
+// rate limit is cut off until its token bucket refills. Everything lives in fixed tables and takes
+// constant time per message: this runs in the MQTT task, for every message.
+
+#define RX_FILTER_SETS       32     // Recent message IDs, two per set
+#define RX_FILTER_WAYS       2
+#define RX_FILTER_SENDERS    8      // Token buckets, the least recently heard sender gives its bucket up
+#define RX_FILTER_TOKEN      60000  // One message, buckets gain the rate per minute every millisecond
+#define RX_FILTER_HASH_SEED  14695981039346656037ull
+#define RX_FILTER_HASH_PRIME 1099511628211ull
+
+typedef struct {
+    uint32_t sender;  // Hash of the sender, 0 for a free bucket
+    uint32_t tokens;
+    int64_t  last_ms;
+    bool     limited;  // Dropping, only logged when it starts
+} rx_bucket_t;
+
+static char const TAG[] = "rx_filter";
+
+// Only the MQTT task filters, the counters are read by the render task
+static char                 own_sender[EVENT_JSON_SENDER_LENGTH] = "";
+static uint64_t             recent[RX_FILTER_SETS][RX_FILTER_WAYS];
+static uint8_t              recent_next[RX_FILTER_SETS];  // Way to replace next in each set
+static rx_bucket_t          buckets[RX_FILTER_SENDERS];
+static atomic_uint_fast32_t dropped_duplicates = 0;
+static atomic_uint_fast32_t dropped_echoes     = 0;
+static atomic_uint_fast32_t dropped_flooded    = 0;
+
+static uint64_t hash(uint64_t value, void const* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        value = (value ^ ((uint8_t const*)data)[i]) * RX_FILTER_HASH_PRIME;
+    }
+    return value;
+}
+
+void rx_filter_init(char const* sender) {
+    snprintf(own_sender, sizeof(own_sender), "%s", sender);
+    memset(recent, 0, sizeof(recent));
+    memset(recent_next, 0, sizeof(recent_next));
+    memset(buckets, 0, sizeof(buckets));
+}
+
+// Senders start counting at 1 again when they restart, the send time tells those events apart
+static bool seen_before(event_json_event_t const* event) {
+    uint64_t id = hash(RX_FILTER_HASH_SEED, event->sender, strlen(event->sender));
+    id          = hash(id, &event->sequence, sizeof(event->sequence));
+    if (event->fields & EVENT_JSON_FIELD_TIMESTAMP) {
+        id = hash(id, &event->timestamp, sizeof(event->timestamp));
+    }
+    id += id == 0;  // 0 marks a free entry
+
+    uint64_t* set = recent[id % RX_FILTER_SETS];
+    for (size_t way = 0; way < RX_FILTER_WAYS; way++) {
+        if (set[way] == id) {
+            return true;
+        }
+    }
+    uint8_t* next = &recent_next[id % RX_FILTER_SETS];
+    set[*next]    = id;
+    *next         = (*next + 1) % RX_FILTER_WAYS;
+    return false;
+}
+
+static rx_bucket_t* bucket_for(uint32_t sender, int64_t now_ms) {
+    rx_bucket_t* oldest = &buckets[0];
+    for (size_t i = 0; i < RX_FILTER_SENDERS; i++) {
+        if (buckets[i].sender == sender) {
+            return &buckets[i];
+        }
+        if (buckets[i].sender == 0 || buckets[i].last_ms < oldest->last_ms) {
+            oldest = &buckets[i];
+            if (oldest->sender == 0) break;
+        }
+    }
+    *oldest = (rx_bucket_t){
+        .sender  = sender,
+        .tokens  = CONFIG_NOTIFIER_RX_BURST * RX_FILTER_TOKEN,
+        .last_ms = now_ms,
+    };
+    return oldest;
+}
+
+static bool take_token(char const* key, size_t key_length) {
+    uint32_t sender = (uint32_t)hash(RX_FILTER_HASH_SEED, key, key_length);
+    if (sender == 0) sender = 1;  // 0 marks a free bucket
+
+    int64_t      now_ms = esp_timer_get_time() / 1000;
+    rx_bucket_t* bucket = bucket_for(sender, now_ms);
+    uint64_t     refill = (uint64_t)(now_ms - bucket->last_ms) * CONFIG_NOTIFIER_RX_RATE_PER_MIN;
+    uint64_t     tokens = bucket->tokens + refill;
+    uint32_t     limit  = CONFIG_NOTIFIER_RX_BURST * RX_FILTER_TOKEN;
+    bucket->tokens      = tokens < limit ? tokens : limit;
+    bucket->last_ms     = now_ms;
+
+    if (bucket->tokens < RX_FILTER_TOKEN) {
+        if (!bucket->limited) {
+            ESP_LOGW(TAG, "Rate limiting %.*s", (int)key_length, key);
+        }
+        bucket->limited = true;
+        return false;
+    }
+    bucket->tokens  = bucket->tokens - RX_FILTER_TOKEN;
+    bucket->limited = false;
+    return true;
+}
+
+// Event is NULL for a payload that is not an event, those are limited per topic
+bool rx_filter_accept(char const* topic, size_t topic_length, event_json_event_t const* event) {
+    bool has_sender = event != NULL && (event->fields & EVENT_JSON_FIELD_SENDER);
+    if (has_sender && strcmp(event->sender, own_sender) == 0) {
+        atomic_fetch_add_explicit(&dropped_echoes, 1, memory_order_relaxed);
+        return false;
+    }
+    if (has_sender && (event->fields & EVENT_JSON_FIELD_SEQUENCE) && seen_before(event)) {
+        atomic_fetch_add_explicit(&dropped_duplicates, 1, memory_order_relaxed);
+        return false;
+    }
+    bool allowed = has_sender ? take_token(event->sender, strlen(event->sender)) : take_token(topic, topic_length);
+    if (!allowed) {
+        atomic_fetch_add_explicit(&dropped_flooded, 1, memory_order_relaxed);
+    }
+    return allowed;
+}
+
+void rx_filter_get_stats(rx_filter_stats_t* out) {
+    out->duplicates = atomic_load_explicit(&dropped_duplicates, memory_order_relaxed);
+    out->echoes     = atomic_load_explicit(&dropped_echoes, memory_order_relaxed);
+    out->flooded    = atomic_load_explicit(&dropped_flooded, memory_order_relaxed);
+}
+
+// Changes whenever a message is dropped
+uint32_t rx_filter_version(void) {
+    return atomic_load_explicit(&dropped_duplicates, memory_order_relaxed) +
+           atomic_load_explicit(&dropped_echoes, memory_order_relaxed) +
+           atomic_load_explicit(&dropped_flooded, memory_order_relaxed);
+}
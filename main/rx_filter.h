@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "event_json.h"
+
+typedef struct {
+    uint32_t duplicates;  // Delivered again, like a QoS 1 redelivery
+    uint32_t echoes;      // Our own events coming back from the broker
+    uint32_t flooded;     // Over the rate limit of their sender
+} rx_filter_stats_t;
+
+void     rx_filter_init(char const* own_sender);
+bool     rx_filter_accept(char const* topic, size_t topic_length, event_json_event_t const* event);
+void     rx_filter_get_stats(rx_filter_stats_t* out);
+uint32_t rx_filter_version(void);
@@ -0,0 +1,98 @@
+#include "sd_bench.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "sdcard.h"
+
+// Measures what the mounted card actually delivers through FATFS: sequential throughput for
+// streaming (logs, animations) and random single-transfer IOPS for indexed access. Uses a scratch
+// file that is removed afterwards.
+
+#define SD_BENCH_RANDOM_OPS 128
+
+static char const TAG[] = "sd_bench";
+
+static float mbps(size_t bytes, int64_t us) {
+    return us > 0 ? (float)bytes / (float)us : 0.0f;  // Bytes per microsecond is MB/s
+}
+
+static float iops(int64_t us) {
+    return us > 0 ? SD_BENCH_RANDOM_OPS * 1000000.0f / (float)us : 0.0f;
+}
+
+// One pass over the file, sequential or at random transfer-aligned offsets
+static esp_err_t pass(int fd, uint8_t* buffer, size_t file_size, size_t transfer_size, bool writing, bool at_random,
+                      int64_t* elapsed) {
+    size_t  transfers = file_size / transfer_size;
+    size_t  count     = at_random ? SD_BENCH_RANDOM_OPS : transfers;
+    int64_t start     = esp_timer_get_time();
+
+    if (lseek(fd, 0, SEEK_SET) < 0) return ESP_FAIL;
+    for (size_t i = 0; i < count; i++) {
+        if (at_random && lseek(fd, (off_t)(esp_random() % transfers) * transfer_size, SEEK_SET) < 0) {
+            return ESP_FAIL;
+        }
+        ssize_t done = writing ? write(fd, buffer, transfer_size) : read(fd, buffer, transfer_size);
+        if (done != (ssize_t)transfer_size) {
+            return ESP_FAIL;
+        }
+    }
+    // Writes only count once they are on the card
+    if (writing && fsync(fd) != 0) {
+        return ESP_FAIL;
+    }
+
+    *elapsed = esp_timer_get_time() - start;
+    return ESP_OK;
+}
+
+esp_err_t sd_bench_run(char const* path, size_t file_size, size_t transfer_size, sd_bench_result_t* result) {
+    if (transfer_size == 0 || file_size < transfer_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // DMA capable and cache line aligned, so the SD driver does not have to bounce every transfer
+    uint8_t* buffer = heap_caps_aligned_alloc(64, transfer_size, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (buffer == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (size_t i = 0; i < transfer_size; i++) {
+        buffer[i] = i;
+    }
+
+    esp_err_t res = ESP_FAIL;
+    int       fd  = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd >= 0) {
+        int64_t seq_write = 0, seq_read = 0, rand_write = 0, rand_read = 0;
+        res = pass(fd, buffer, file_size, transfer_size, true, false, &seq_write);
+        if (res == ESP_OK) res = pass(fd, buffer, file_size, transfer_size, false, false, &seq_read);
+        if (res == ESP_OK) res = pass(fd, buffer, file_size, transfer_size, true, true, &rand_write);
+        if (res == ESP_OK) res = pass(fd, buffer, file_size, transfer_size, false, true, &rand_read);
+        close(fd);
+        unlink(path);
+
+        if (res == ESP_OK) {
+            size_t used             = file_size / transfer_size * transfer_size;
+            result->seq_write_mbps  = mbps(used, seq_write);
+            result->seq_read_mbps   = mbps(used, seq_read);
+            result->rand_write_iops = iops(rand_write);
+            result->rand_read_iops  = iops(rand_read);
+            result->cluster_size    = sd_cluster_size();
+            ESP_LOGI(TAG,
+                     "%u KiB in %u byte transfers on %u byte clusters: write %.2f MB/s, read %.2f MB/s, "
+                     "random write %.0f IOPS, random read %.0f IOPS",
+                     (unsigned)(file_size / 1024), (unsigned)transfer_size, (unsigned)result->cluster_size,
+                     result->seq_write_mbps, result->seq_read_mbps, result->rand_write_iops, result->rand_read_iops);
+        }
+    }
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Benchmark on %s failed", path);
+    }
+
+    heap_caps_free(buffer);
+    return res;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    float    seq_write_mbps;
+    float    seq_read_mbps;
+    float    rand_write_iops;
+    float    rand_read_iops;
+    uint32_t cluster_size;  // Of the filesystem the benchmark ran on, 0 if unknown
+} sd_bench_result_t;
+
+esp_err_t sd_bench_run(char const* path, size_t file_size, size_t transfer_size, sd_bench_result_t* result);
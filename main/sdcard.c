@@ -1,8 +1,10 @@
 #include "sdcard.h"
+#include "diskio_sdmmc.h"
 #include "driver/sdmmc_host.h"
 #include "esp_log.h"
 #include "esp_vfs.h"
 #include "esp_vfs_fat.h"
+#include "ff.h"
 #include "sd_pwr_ctrl_by_on_chip_ldo.h"
 #include "sdmmc_cmd.h"
 
@@ -25,64 +27,76 @@ sd_pwr_ctrl_handle_t initialize_sd_ldo(void) {
     return pwr_ctrl_handle;
 }
 
-esp_err_t sd_mount(sd_pwr_ctrl_handle_t pwr_ctrl_handle) {
-    esp_err_t res;
+static sd_mode_t     mode = SD_MODE_NONE;
+static sdmmc_card_t* card = NULL;
 
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = false, .max_files = 5, .allocation_unit_size = 16 * 1024};
+static esp_vfs_fat_sdmmc_mount_config_t const mount_config = {
+    .format_if_mount_failed = false,
+    .max_files              = 8,  // Message log 5, GIF clip 1, offline log 1, settings or bench file 1
+    .allocation_unit_size   = CONFIG_NOTIFIER_SD_ALLOCATION_UNIT,
+};
+
+static esp_err_t mount_result(esp_err_t res, sd_mode_t mounted, sdmmc_card_t* mounted_card) {
+    if (res != ESP_OK) {
+        if (res == ESP_FAIL) {
+            ESP_LOGE(TAG, "Failed to mount SD card filesystem.");
+        } else {
+            ESP_LOGE(TAG, "Failed to initialize the SD card (%s). ", esp_err_to_name(res));
+        }
+        status = SD_STATUS_ERROR;
+        return res;
+    }
+    ESP_LOGI(TAG, "Filesystem mounted");
+    status = SD_STATUS_OK;
+    mode   = mounted;
+    card   = mounted_card;
+    return ESP_OK;
+}
 
-    sdmmc_card_t* card;
+static esp_err_t mount_sdmmc(sd_pwr_ctrl_handle_t pwr_ctrl_handle, uint8_t width, int max_freq_khz) {
+    sdmmc_card_t* mounted_card;
     const char    mount_point[] = "/sd";
-    ESP_LOGI(TAG, "Initializing SD card");
+    ESP_LOGI(TAG, "Initializing SD card, SDMMC %u-bit at %d kHz", width, max_freq_khz);
 
     sdmmc_host_t host    = SDMMC_HOST_DEFAULT();
     host.pwr_ctrl_handle = pwr_ctrl_handle;
+    host.max_freq_khz    = max_freq_khz;
 
     sdmmc_slot_config_t slot_config = {
         .clk   = GPIO_NUM_43,
         .cmd   = GPIO_NUM_44,
         .d0    = GPIO_NUM_39,
-        .d1    = GPIO_NUM_40,
-        .d2    = GPIO_NUM_41,
-        .d3    = GPIO_NUM_42,
+        .d1    = width == 4 ? GPIO_NUM_40 : GPIO_NUM_NC,
+        .d2    = width == 4 ? GPIO_NUM_41 : GPIO_NUM_NC,
+        .d3    = width == 4 ? GPIO_NUM_42 : GPIO_NUM_NC,
         .d4    = GPIO_NUM_NC,
         .d5    = GPIO_NUM_NC,
         .d6    = GPIO_NUM_NC,
         .d7    = GPIO_NUM_NC,
         .cd    = SDMMC_SLOT_NO_CD,
         .wp    = SDMMC_SLOT_NO_WP,
-        .width = 4,
+        .width = width,
         .flags = 0,
     };
 
     ESP_LOGI(TAG, "Mounting filesystem");
-    res = esp_vfs_fat_sdmmc_mount(mount_point, &host, &slot_config, &mount_config, &card);
-
-    if (res != ESP_OK) {
-        if (res == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount SD card filesystem.");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize the SD card (%s). ", esp_err_to_name(res));
-        }
-        status = SD_STATUS_ERROR;
-        return res;
+    esp_err_t res = esp_vfs_fat_sdmmc_mount(mount_point, &host, &slot_config, &mount_config, &mounted_card);
+    if (res == ESP_OK) {
+        sdmmc_card_print_info(stdout, mounted_card);
     }
-    ESP_LOGI(TAG, "Filesystem mounted");
+    return mount_result(res, width == 4 ? SD_MODE_SDMMC_4BIT : SD_MODE_SDMMC_1BIT, mounted_card);
+}
 
-    sdmmc_card_print_info(stdout, card);
-    status = SD_STATUS_OK;
-    return ESP_OK;
+esp_err_t sd_mount(sd_pwr_ctrl_handle_t pwr_ctrl_handle) {
+    return mount_sdmmc(pwr_ctrl_handle, 4, SDMMC_FREQ_DEFAULT);
 }
 
 esp_err_t sd_mount_spi(sd_pwr_ctrl_handle_t pwr_ctrl_handle) {
     esp_err_t res;
 
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = false, .max_files = 5, .allocation_unit_size = 16 * 1024};
-
-    sdmmc_card_t* card;
+    sdmmc_card_t* mounted_card;
     const char    mount_point[] = "/sd";
-    ESP_LOGI(TAG, "Initializing SD card");
+    ESP_LOGI(TAG, "Initializing SD card, SPI");
 
     sdmmc_host_t host    = SDSPI_HOST_DEFAULT();
     host.pwr_ctrl_handle = pwr_ctrl_handle;
@@ -93,7 +107,7 @@ esp_err_t sd_mount_spi(sd_pwr_ctrl_handle_t pwr_ctrl_handle) {
         .sclk_io_num     = GPIO_NUM_43,
         .quadwp_io_num   = -1,
         .quadhd_io_num   = -1,
-        .max_transfer_sz = 4000,
+        .max_transfer_sz = CONFIG_NOTIFIER_SD_SPI_TRANSFER,
     };
 
     res = spi_bus_initialize(host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
@@ -108,20 +122,36 @@ esp_err_t sd_mount_spi(sd_pwr_ctrl_handle_t pwr_ctrl_handle) {
     slot_config.host_id               = host.slot;
 
     ESP_LOGI(TAG, "Mounting filesystem");
-    res = esp_vfs_fat_sdspi_mount(mount_point, &host, &slot_config, &mount_config, &card);
+    res = esp_vfs_fat_sdspi_mount(mount_point, &host, &slot_config, &mount_config, &mounted_card);
+    if (res != ESP_OK) {
+        spi_bus_free(host.slot);
+    }
+    return mount_result(res, SD_MODE_SPI, mounted_card);
+}
 
+// Tries the bus modes from fastest to slowest and keeps the first one that mounts. A failed
+// SDMMC attempt releases the host again, so the shared pins are free for the next attempt.
+esp_err_t sd_mount_auto(sd_pwr_ctrl_handle_t pwr_ctrl_handle) {
+    esp_err_t res = mount_sdmmc(pwr_ctrl_handle, 4, SDMMC_FREQ_HIGHSPEED);
+    if (res == ESP_OK) return res;
+    res = mount_sdmmc(pwr_ctrl_handle, 4, SDMMC_FREQ_DEFAULT);
+    if (res == ESP_OK) return res;
+    res = mount_sdmmc(pwr_ctrl_handle, 1, SDMMC_FREQ_DEFAULT);
+    if (res == ESP_OK) return res;
+    ESP_LOGW(TAG, "SDMMC failed, falling back to SPI");
+    return sd_mount_spi(pwr_ctrl_handle);
+}
+
+// Recreates the filesystem with the allocation unit from the mount config. Erases everything on
+// the card, so it must run before anything opens a file on it.
+esp_err_t sd_format(void) {
+    if (card == NULL) return ESP_ERR_INVALID_STATE;
+    ESP_LOGW(TAG, "Formatting the SD card with %d byte clusters", CONFIG_NOTIFIER_SD_ALLOCATION_UNIT);
+    esp_err_t res = esp_vfs_fat_sdcard_format("/sd", card);
     if (res != ESP_OK) {
-        if (res == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount SD card filesystem.");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize the SD card (%s). ", esp_err_to_name(res));
-        }
-        status = SD_STATUS_ERROR;
-        return res;
+        ESP_LOGE(TAG, "Failed to format the SD card (%s)", esp_err_to_name(res));
     }
-    ESP_LOGI(TAG, "Filesystem mounted");
-    status = SD_STATUS_OK;
-    return ESP_OK;
+    return res;
 }
 
 void test_sd(void) {
@@ -141,4 +171,47 @@ void test_sd(void) {
 
 sd_status_t sd_status(void) {
     return status;
+}
+
+sd_mode_t sd_mode(void) {
+#if defined(CONFIG_BSP_TARGET_TANMATSU) || defined(CONFIG_BSP_TARGET_KONSOOL) || \
+    defined(CONFIG_BSP_TARGET_HACKERHOTEL_2026)
+    return mode;
+#else
+    return SD_MODE_NONE;
+#endif
+}
+
+// Cluster size of the mounted filesystem, which only matches the configured allocation unit when
+// the card was formatted by sd_format.
+uint32_t sd_cluster_size(void) {
+#if defined(CONFIG_BSP_TARGET_TANMATSU) || defined(CONFIG_BSP_TARGET_KONSOOL) || \
+    defined(CONFIG_BSP_TARGET_HACKERHOTEL_2026)
+    if (card == NULL) return 0;
+    char const drive[] = {(char)('0' + ff_diskio_get_pdrv_card(card)), ':', '\0'};
+    FATFS*     fs;
+    DWORD      free_clusters;
+    if (f_getfree(drive, &free_clusters, &fs) != FR_OK) return 0;
+#if FF_MAX_SS != FF_MIN_SS
+    return (uint32_t)fs->csize * fs->ssize;
+#else
+    return (uint32_t)fs->csize * FF_MAX_SS;
+#endif
+#else
+    return 0;
+#endif
+}
+
+char const* sd_mode_name(sd_mode_t value) {
+    switch (value) {
+        case SD_MODE_SDMMC_4BIT:
+            return "SDMMC 4-bit";
+        case SD_MODE_SDMMC_1BIT:
+            return "SDMMC 1-bit";
+        case SD_MODE_SPI:
+            return "SPI";
+        case SD_MODE_NONE:
+        default:
+            return "none";
+    }
 }
\ No newline at end of file
@@ -13,8 +13,20 @@ typedef enum {
     SD_STATUS_LAST,
 } sd_status_t;
 
+typedef enum {
+    SD_MODE_NONE,
+    SD_MODE_SDMMC_4BIT,
+    SD_MODE_SDMMC_1BIT,
+    SD_MODE_SPI,
+} sd_mode_t;
+
 sd_pwr_ctrl_handle_t initialize_sd_ldo(void);
 esp_err_t            sd_mount(sd_pwr_ctrl_handle_t pwr_ctrl_handle);
 esp_err_t            sd_mount_spi(sd_pwr_ctrl_handle_t pwr_ctrl_handle);
+esp_err_t            sd_mount_auto(sd_pwr_ctrl_handle_t pwr_ctrl_handle);
+esp_err_t            sd_format(void);
 void                 test_sd(void);
 sd_status_t          sd_status(void);
+sd_mode_t            sd_mode(void);
+uint32_t             sd_cluster_size(void);
+char const*          sd_mode_name(sd_mode_t mode);
@@ -0,0 +1,297 @@
+#include "settings.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+
+// Application settings. The source of truth is a small key=value file on the SD card:
+//
+//     # Lines starting with # are comments
+//     broker=mqtt://broker.hivemq.com
+//     topic=/esp32/coffee
+//     button=Nyan
+//     button=Coffee
+//     button=Lunch
+//     key=a shared secret of at least 16 characters
+//     route=/office/+/floor3 led
+//     route=/office/dm/tanmatsu-1a2b3c/# display,led,animation
+//
+// Messages on the topic are always shown. A route subscribes to one more topic filter, with MQTT
+// wildcards, and names what to do with its messages: display, led, animation, stats or all.
+//
+// Parsing it means mounting the card, so the validated result is kept in NVS as a binary snapshot
+// together with a hash of the file it came from. Boot only reads the snapshot; the file is checked
+// later, in the background, and only parsed again when its hash differs.
+
+#define SETTINGS_NAMESPACE   "settings"
+#define SETTINGS_KEY         "snapshot"
+#define SETTINGS_VERSION     3
+#define SETTINGS_MAX_FILE    2048
+#define SETTINGS_HASH_SEED   2166136261u
+#define SETTINGS_HASH_FACTOR 16777619u
+
+typedef struct {
+    uint32_t   version;
+    uint32_t   hash;  // FNV-1a of the file the settings were parsed from
+    settings_t settings;
+} settings_snapshot_t;
+
+static char const TAG[] = "settings";
+
+static settings_t const defaults = {
+    .broker       = "mqtt://broker.hivemq.com",
+    .topic        = "/esp32/coffee",
+    .button_count = 3,
+    .buttons      = {"Nyan", "Coffee", "Lunch"},
+};
+
+static settings_t  settings                            = {0};
+static uint32_t    settings_hash                       = 0;
+static char const* button_labels[SETTINGS_MAX_BUTTONS] = {0};
+
+static uint32_t hash(char const* data, size_t length) {
+    uint32_t value = SETTINGS_HASH_SEED;
+    for (size_t i = 0; i < length; i++) {
+        value = (value ^ (uint8_t)data[i]) * SETTINGS_HASH_FACTOR;
+    }
+    return value;
+}
+
+static bool is_terminated(char const* text, size_t size) {
+    return memchr(text, '\0', size) != NULL;
+}
+
+static bool validate(settings_t const* candidate) {
+    if (!is_terminated(candidate->broker, sizeof(candidate->broker)) ||
+        !is_terminated(candidate->topic, sizeof(candidate->topic)) ||
+        !is_terminated(candidate->key, sizeof(candidate->key))) {
+        return false;
+    }
+    if (strncmp(candidate->broker, "mqtt://", 7) != 0 && strncmp(candidate->broker, "mqtts://", 8) != 0 &&
+        strncmp(candidate->broker, "ws://", 5) != 0 && strncmp(candidate->broker, "wss://", 6) != 0) {
+        ESP_LOGE(TAG, "Broker has to be an mqtt://, mqtts://, ws:// or wss:// URI");
+        return false;
+    }
+    // Events are published to the topic, so no wildcards
+    if (candidate->topic[0] == '\0' || strpbrk(candidate->topic, "+#") != NULL) {
+        ESP_LOGE(TAG, "Topic has to be a non-empty topic without wildcards");
+        return false;
+    }
+    if (candidate->key[0] != '\0' && strlen(candidate->key) < SETTINGS_KEY_MIN) {
+        ESP_LOGE(TAG, "The key needs at least %d characters", SETTINGS_KEY_MIN);
+        return false;
+    }
+    if (candidate->button_count == 0 || candidate->button_count > SETTINGS_MAX_BUTTONS) {
+        ESP_LOGE(TAG, "Between 1 and %d buttons are needed", SETTINGS_MAX_BUTTONS);
+        return false;
+    }
+    for (size_t i = 0; i < candidate->button_count; i++) {
+        if (!is_terminated(candidate->buttons[i], SETTINGS_LABEL_LENGTH) || candidate->buttons[i][0] == '\0') {
+            return false;
+        }
+    }
+    if (candidate->route_count > SETTINGS_MAX_ROUTES) {
+        return false;
+    }
+    for (size_t i = 0; i < candidate->route_count; i++) {
+        settings_route_t const* route = &candidate->routes[i];
+        if (!is_terminated(route->filter, sizeof(route->filter)) || !topic_router_valid_filter(route->filter)) {
+            ESP_LOGE(TAG, "Route %u has an invalid topic filter", (unsigned)(i + 1));
+            return false;
+        }
+        if (route->handlers == 0 || (route->handlers & ~TOPIC_HANDLER_ALL) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static char* trim(char* text) {
+    while (isspace((unsigned char)*text)) text++;
+    char* end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return text;
+}
+
+static bool copy_value(char* out, size_t size, char const* value, char const* key, int line) {
+    if (strlen(value) >= size) {
+        ESP_LOGE(TAG, "Line %d: %s is longer than %u characters", line, key, (unsigned)(size - 1));
+        return false;
+    }
+    // Zero the rest, snapshots are compared byte for byte
+    memset(out, 0, size);
+    memcpy(out, value, strlen(value));
+    return true;
+}
+
+// route=<filter> <handler>[,<handler>...]
+static bool parse_route(char* value, settings_t* out, int line) {
+    if (out->route_count == SETTINGS_MAX_ROUTES) {
+        ESP_LOGE(TAG, "Line %d: more than %d routes", line, SETTINGS_MAX_ROUTES);
+        return false;
+    }
+    char* separator = strpbrk(value, " \t");
+    if (separator == NULL) {
+        ESP_LOGE(TAG, "Line %d: expected route=<filter> <handlers>", line);
+        return false;
+    }
+    *separator = '\0';
+    char* names = trim(separator + 1);
+
+    settings_route_t* route = &out->routes[out->route_count];
+    if (!copy_value(route->filter, sizeof(route->filter), value, "route", line)) return false;
+    if (!topic_router_parse_handlers(names, &route->handlers)) {
+        ESP_LOGE(TAG, "Line %d: unknown handler in %s", line, names);
+        return false;
+    }
+    out->route_count++;
+    return true;
+}
+
+// Parses the file contents in place, starting from the defaults for anything not set
+static bool parse(char* text, settings_t* out) {
+    *out             = defaults;
+    bool has_buttons = false;
+    int  line_number = 0;
+
+    for (char* line = strtok(text, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        line_number++;
+        line = trim(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+
+        char* separator = strchr(line, '=');
+        if (separator == NULL) {
+            ESP_LOGE(TAG, "Line %d: expected key=value", line_number);
+            return false;
+        }
+        *separator  = '\0';
+        char* key   = trim(line);
+        char* value = trim(separator + 1);
+
+        if (strcmp(key, "broker") == 0) {
+            if (!copy_value(out->broker, sizeof(out->broker), value, key, line_number)) return false;
+        } else if (strcmp(key, "topic") == 0) {
+            if (!copy_value(out->topic, sizeof(out->topic), value, key, line_number)) return false;
+        } else if (strcmp(key, "key") == 0) {
+            if (!copy_value(out->key, sizeof(out->key), value, key, line_number)) return false;
+        } else if (strcmp(key, "button") == 0) {
+            // The first button replaces the default set
+            if (!has_buttons) out->button_count = 0;
+            has_buttons = true;
+            if (out->button_count == SETTINGS_MAX_BUTTONS) {
+                ESP_LOGE(TAG, "Line %d: more than %d buttons", line_number, SETTINGS_MAX_BUTTONS);
+                return false;
+            }
+            if (!copy_value(out->buttons[out->button_count], SETTINGS_LABEL_LENGTH, value, key, line_number)) {
+                return false;
+            }
+            out->button_count++;
+        } else if (strcmp(key, "route") == 0) {
+            if (!parse_route(value, out, line_number)) return false;
+        } else {
+            ESP_LOGW(TAG, "Line %d: ignoring unknown key %s", line_number, key);
+        }
+    }
+    return validate(out);
+}
+
+static void apply(settings_t const* next, uint32_t next_hash) {
+    settings      = *next;
+    settings_hash = next_hash;
+    for (size_t i = 0; i < SETTINGS_MAX_BUTTONS; i++) {
+        button_labels[i] = settings.buttons[i];
+    }
+}
+
+// Loads the snapshot from NVS, or the defaults when there is none. Never touches the SD card.
+esp_err_t settings_load(void) {
+    apply(&defaults, 0);
+
+    nvs_handle_t handle;
+    esp_err_t    res = nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &handle);
+    if (res != ESP_OK) {
+        return res == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : res;
+    }
+
+    static settings_snapshot_t snapshot;
+    size_t                     size = sizeof(snapshot);
+    res                             = nvs_get_blob(handle, SETTINGS_KEY, &snapshot, &size);
+    nvs_close(handle);
+    if (res == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (res != ESP_OK || size != sizeof(snapshot) || snapshot.version != SETTINGS_VERSION ||
+        !validate(&snapshot.settings)) {
+        ESP_LOGW(TAG, "Ignoring invalid settings snapshot");
+        return ESP_OK;
+    }
+
+    apply(&snapshot.settings, snapshot.hash);
+    ESP_LOGI(TAG, "Loaded settings: %s %s, %u buttons, %u routes, %s", settings.broker, settings.topic,
+             settings.button_count, settings.route_count, settings.key[0] ? "encrypted" : "not encrypted");
+    return ESP_OK;
+}
+
+settings_t const* settings_get(void) {
+    return &settings;
+}
+
+char const* const* settings_button_labels(void) {
+    return button_labels;
+}
+
+// Checks the settings file against the snapshot, and parses and stores it when it changed. Returns
+// true when a new snapshot was stored, which takes effect on the next boot. Call with the card mounted.
+bool settings_refresh(char const* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        ESP_LOGI(TAG, "No settings file at %s", path);
+        return false;
+    }
+
+    static char text[SETTINGS_MAX_FILE + 1];
+    size_t      length = fread(text, 1, SETTINGS_MAX_FILE + 1, file);
+    fclose(file);
+    if (length > SETTINGS_MAX_FILE) {
+        ESP_LOGE(TAG, "%s is larger than %d bytes", path, SETTINGS_MAX_FILE);
+        return false;
+    }
+    text[length] = '\0';
+
+    uint32_t file_hash = hash(text, length);
+    if (file_hash == settings_hash) {
+        return false;  // Unchanged, which is the common case
+    }
+
+    static settings_snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    if (!parse(text, &snapshot.settings)) {
+        ESP_LOGE(TAG, "Invalid settings in %s, keeping the current ones", path);
+        return false;
+    }
+    snapshot.version = SETTINGS_VERSION;
+    snapshot.hash    = file_hash;
+
+    nvs_handle_t handle;
+    esp_err_t    res = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &handle);
+    if (res == ESP_OK) {
+        res = nvs_set_blob(handle, SETTINGS_KEY, &snapshot, sizeof(snapshot));
+        if (res == ESP_OK) res = nvs_commit(handle);
+        nvs_close(handle);
+    }
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store settings snapshot: %s", esp_err_to_name(res));
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Stored new settings from %s", path);
+
+    // An edit that only touched comments still ends up with the active settings
+    if (memcmp(&snapshot.settings, &settings, sizeof(settings)) == 0) {
+        settings_hash = file_hash;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "topic_router.h"
+
+#define SETTINGS_FILE          "/sd/notifier/config.txt"
+#define SETTINGS_BROKER_LENGTH 128
+#define SETTINGS_TOPIC_LENGTH  48  // Has to fit the outbox topic
+#define SETTINGS_LABEL_LENGTH  16
+#define SETTINGS_MAX_BUTTONS   4
+#define SETTINGS_KEY_LENGTH    65  // Group secret, empty when messages are not encrypted
+#define SETTINGS_KEY_MIN       16
+#define SETTINGS_MAX_ROUTES    (TOPIC_ROUTER_MAX_ROUTES - 1)  // Besides the topic, which is always shown
+
+typedef struct {
+    char    filter[SETTINGS_TOPIC_LENGTH];
+    uint8_t handlers;  // topic_handler_t flags
+} settings_route_t;
+
+typedef struct {
+    char             broker[SETTINGS_BROKER_LENGTH];
+    char             topic[SETTINGS_TOPIC_LENGTH];
+    uint8_t          button_count;
+    char             buttons[SETTINGS_MAX_BUTTONS][SETTINGS_LABEL_LENGTH];
+    char             key[SETTINGS_KEY_LENGTH];
+    uint8_t          route_count;
+    settings_route_t routes[SETTINGS_MAX_ROUTES];
+} settings_t;
+
+esp_err_t          settings_load(void);
+settings_t const*  settings_get(void);
+char const* const* settings_button_labels(void);
+bool               settings_refresh(char const* path);
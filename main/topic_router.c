@@ -0,0 +1,188 @@
+#include "topic_router.h"
+#include <string.h>
+
+// Maps the topic of a received message to what should happen with it. The subscribed filters,
+// with their + and # wildcards, are kept in a trie with one node per topic level: matching walks
+// it level by level and visits every node at most once, so the cost grows with the topic length
+// and the number of routes, and nothing is allocated. Node level text points into the copies of
+// the filters. The router is built once at boot, before the MQTT client starts, and only read
+// after that.
+
+typedef struct {
+    char const* level;
+    uint8_t     length;
+    uint8_t     child;     // First child, 0 for none: the root is never a child
+    uint8_t     next;      // Next sibling
+    uint8_t     handlers;  // Of the routes whose filter ends here
+} topic_node_t;
+
+static char         filters[TOPIC_ROUTER_MAX_ROUTES][TOPIC_ROUTER_FILTER_LENGTH];
+static size_t       filter_count = 0;
+static topic_node_t nodes[TOPIC_ROUTER_MAX_NODES];
+static size_t       node_count = 1;
+
+static struct {
+    char const* name;
+    uint8_t     handlers;
+} const handler_names[] = {
+    {"display", TOPIC_HANDLER_DISPLAY},
+    {"led", TOPIC_HANDLER_LED},
+    {"animation", TOPIC_HANDLER_ANIMATION},
+    {"stats", TOPIC_HANDLER_STATS},
+    {"all", TOPIC_HANDLER_ALL},
+};
+
+void topic_router_clear(void) {
+    memset(nodes, 0, sizeof(nodes));
+    node_count   = 1;
+    filter_count = 0;
+}
+
+// A + or # stands for a whole level, and # only at the end
+bool topic_router_valid_filter(char const* filter) {
+    size_t length = strlen(filter);
+    if (length == 0 || length >= TOPIC_ROUTER_FILTER_LENGTH) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (filter[i] != '+' && filter[i] != '#') {
+            continue;
+        }
+        bool starts_level = i == 0 || filter[i - 1] == '/';
+        bool ends_level   = i + 1 == length || filter[i + 1] == '/';
+        if (!starts_level || !ends_level || (filter[i] == '#' && i + 1 != length)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t count_levels(char const* filter) {
+    size_t levels = 1;
+    for (; *filter != '\0'; filter++) {
+        levels += *filter == '/';
+    }
+    return levels;
+}
+
+static uint8_t find_child(uint8_t node, char const* level, size_t length) {
+    for (uint8_t child = nodes[node].child; child != 0; child = nodes[child].next) {
+        if (nodes[child].length == length && memcmp(nodes[child].level, level, length) == 0) {
+            return child;
+        }
+    }
+    return 0;
+}
+
+bool topic_router_add(char const* filter, uint8_t handlers) {
+    if (!topic_router_valid_filter(filter)) {
+        return false;
+    }
+
+    // The same filter in two routes is a single subscription
+    size_t index = 0;
+    while (index < filter_count && strcmp(filters[index], filter) != 0) index++;
+    if (index == filter_count) {
+        if (filter_count == TOPIC_ROUTER_MAX_ROUTES || node_count + count_levels(filter) > TOPIC_ROUTER_MAX_NODES) {
+            return false;
+        }
+        strcpy(filters[filter_count++], filter);
+    }
+
+    char const* level = filters[index];
+    uint8_t     node  = 0;
+    while (true) {
+        char const* slash  = strchr(level, '/');
+        size_t      length = slash != NULL ? (size_t)(slash - level) : strlen(level);
+        uint8_t     child  = find_child(node, level, length);
+        if (child == 0) {
+            child             = node_count++;
+            nodes[child]      = (topic_node_t){.level = level, .length = length, .next = nodes[node].child};
+            nodes[node].child = child;
+        }
+        node = child;
+        if (slash == NULL) {
+            break;
+        }
+        level = slash + 1;
+    }
+    nodes[node].handlers |= handlers;
+    return true;
+}
+
+static bool is_wildcard(topic_node_t const* node, char wildcard) {
+    return node->length == 1 && node->level[0] == wildcard;
+}
+
+// "a/#" also matches "a" itself
+static uint8_t parent_handlers(uint8_t node) {
+    for (uint8_t child = nodes[node].child; child != 0; child = nodes[child].next) {
+        if (is_wildcard(&nodes[child], '#')) {
+            return nodes[child].handlers;
+        }
+    }
+    return 0;
+}
+
+static uint8_t match_level(uint8_t node, char const* level, char const* end) {
+    char const* slash  = memchr(level, '/', end - level);
+    size_t      length = (slash != NULL ? slash : end) - level;
+    // Wildcards don't match topics starting with $, like $SYS/
+    bool wild = node != 0 || length == 0 || level[0] != '$';
+
+    uint8_t handlers = 0;
+    for (uint8_t child = nodes[node].child; child != 0; child = nodes[child].next) {
+        topic_node_t const* candidate = &nodes[child];
+        if (is_wildcard(candidate, '#')) {
+            handlers |= wild ? candidate->handlers : 0;
+            continue;
+        }
+        bool matches = (wild && is_wildcard(candidate, '+')) ||
+                       (candidate->length == length && memcmp(candidate->level, level, length) == 0);
+        if (!matches) {
+            continue;
+        }
+        if (slash == NULL) {
+            handlers |= candidate->handlers | parent_handlers(child);
+        } else {
+            handlers |= match_level(child, slash + 1, end);
+        }
+    }
+    return handlers;
+}
+
+// Returns the handlers of every route that matches, 0 when none does
+uint8_t topic_router_match(char const* topic, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    return match_level(0, topic, topic + length);
+}
+
+size_t topic_router_count(void) {
+    return filter_count;
+}
+
+char const* topic_router_filter(size_t index) {
+    return index < filter_count ? filters[index] : NULL;
+}
+
+// A comma separated list like "display,led"
+bool topic_router_parse_handlers(char const* names, uint8_t* handlers) {
+    *handlers = 0;
+    while (*names != '\0') {
+        char const* comma  = strchr(names, ',');
+        size_t      length = comma != NULL ? (size_t)(comma - names) : strlen(names);
+        size_t      i      = 0;
+        while (i < sizeof(handler_names) / sizeof(handler_names[0]) &&
+               (strlen(handler_names[i].name) != length || strncmp(handler_names[i].name, names, length) != 0)) {
+            i++;
+        }
+        if (i == sizeof(handler_names) / sizeof(handler_names[0])) {
+            return false;
+        }
+        *handlers |= handler_names[i].handlers;
+        names     += comma != NULL ? length + 1 : length;
+    }
+    return *handlers != 0;
+}
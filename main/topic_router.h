@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOPIC_ROUTER_MAX_ROUTES    8
+#define TOPIC_ROUTER_MAX_NODES     64
+#define TOPIC_ROUTER_FILTER_LENGTH 48
+
+// What happens with a message on a topic, a route can ask for several
+typedef enum {
+    TOPIC_HANDLER_DISPLAY   = 1 << 0,  // Shown in the history and kept in the message log
+    TOPIC_HANDLER_LED       = 1 << 1,  // Blinks the message LED
+    TOPIC_HANDLER_ANIMATION = 1 << 2,  // Plays the clip of the event type
+    TOPIC_HANDLER_STATS     = 1 << 3,  // Counted in the latency statistics
+} topic_handler_t;
+
+#define TOPIC_HANDLER_ALL \
+    (TOPIC_HANDLER_DISPLAY | TOPIC_HANDLER_LED | TOPIC_HANDLER_ANIMATION | TOPIC_HANDLER_STATS)
+
+void        topic_router_clear(void);
+bool        topic_router_add(char const* filter, uint8_t handlers);
+uint8_t     topic_router_match(char const* topic, size_t length);
+size_t      topic_router_count(void);
+char const* topic_router_filter(size_t index);
+bool        topic_router_valid_filter(char const* filter);
+bool        topic_router_parse_handlers(char const* names, uint8_t* handlers);
@@ -0,0 +1,516 @@
+#include "ui.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "app_state.h"
+#include "background.h"
+#include "damage.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "glyph_cache.h"
+#include "latency.h"
+#include "message_ring.h"
+#include "panel.h"
+#include "pax_codecs.h"
+#include "pax_fonts.h"
+#include "pax_gfx.h"
+#include "pax_text.h"
+#include "perf.h"
+#include "render_scheduler.h"
+#include "rx_filter.h"
+
+// Screen layout, drawing and UI state. Only talks to the panel, damage tracker and render
+// scheduler, so it builds for the host as well as for the device.
+
+static char const TAG[] = "ui";
+
+#define HEADER_HEIGHT     30
+#define FOOTER_HEIGHT     30
+#define BUTTON_WIDTH      100
+#define BUTTON_HEIGHT     100
+#define BUTTON_GAP        20
+#define TEXT_FIELD_HEIGTH 24
+#define HISTORY_LINES     8
+#define CLOCK_X           100
+#define CLOCK_Y           140
+#define CLOCK_SIZE        100
+
+static size_t            display_h_res       = 0;
+static size_t            display_v_res       = 0;
+static pax_buf_type_t    display_buf_format  = PAX_BUF_16_565RGB;
+static pax_orientation_t display_orientation = PAX_O_UPRIGHT;
+static bool              display_reversed    = false;
+static pax_buf_t*        fb                  = NULL;
+
+static glyph_cache_t clock_glyphs   = {0};
+static glyph_cache_t text_glyphs_18 = {0};
+static glyph_cache_t text_glyphs_16 = {0};
+
+static uint8_t const* wallpaper      = NULL;
+static size_t         wallpaper_size = 0;
+
+static uint32_t diagnostics_version = 0;
+static time_t   now_time;
+static time_t   clock_drawn_time = 0;
+static bool     clock_seconds    = true;
+
+static char const* menu_title        = "Event Notifier";
+static char const* footer_text       = "Use left/right to navigate. Press return to select. Up/down scrolls history.";
+static char const* default_buttons[] = {"Nyan", "Coffee", "Lunch"};
+
+static char const* const* buttons      = default_buttons;  // Set from the configuration at boot
+static int                button_count = 3;
+
+// What the frame being drawn shows, copied from the application state. Only the render task uses
+// these; the other tasks change the application state and add damage for what they changed.
+static app_state_t frame_state;
+static uint32_t    frame_version   = UINT32_MAX;
+static ui_screen_t rendered_screen = UI_SCREEN_MAIN;
+
+static uint32_t ring_history_count(void);
+
+static ui_history_count_t history_count = ring_history_count;
+static ui_history_get_t   history_get   = message_ring_get;
+
+static ui_animation_draw_t animation_draw  = NULL;
+static bool                animation_clear = false;
+
+// Screen regions, used to invalidate only the parts of the screen a change affects
+static damage_rect_t header_region(void) {
+    return (damage_rect_t){0, 0, display_v_res, HEADER_HEIGHT + 1};
+}
+
+static damage_rect_t footer_region(void) {
+    return (damage_rect_t){0, display_h_res - FOOTER_HEIGHT, display_v_res, FOOTER_HEIGHT};
+}
+
+static damage_rect_t history_region(void) {
+    int height = HISTORY_LINES * TEXT_FIELD_HEIGTH;
+    return (damage_rect_t){0, display_h_res - FOOTER_HEIGHT - height, display_v_res, height};
+}
+
+static damage_rect_t button_region(int index) {
+    int start_x = (display_h_res - (button_count * BUTTON_WIDTH + (button_count - 1) * BUTTON_GAP)) / 2;
+    return (damage_rect_t){start_x + index * (BUTTON_WIDTH + BUTTON_GAP), HEADER_HEIGHT + 40, BUTTON_WIDTH + 1,
+                           BUTTON_HEIGHT + 1};
+}
+
+static damage_rect_t buttons_region(void) {
+    damage_rect_t first = button_region(0);
+    damage_rect_t last  = button_region(button_count - 1);
+    return (damage_rect_t){first.x, first.y, last.x + last.w - first.x, first.h};
+}
+
+static damage_rect_t clock_region(void) {
+    pax_vec2f size = pax_text_size(pax_font_sky_mono, CLOCK_SIZE, "00:00:00");
+    return (damage_rect_t){CLOCK_X, CLOCK_Y, size.x + 1, size.y + 1};
+}
+
+static void damage_region(damage_rect_t region) {
+    damage_add(region.x, region.y, region.w, region.h);
+}
+
+void ui_init(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation, bool reversed) {
+    display_h_res       = h_res;
+    display_v_res       = v_res;
+    display_buf_format  = format;
+    display_orientation = orientation;
+    display_reversed    = reversed;
+
+    // Rasterize the glyphs used every frame once; drawing falls back to pax_draw_text if this fails
+    glyph_cache_set_target(h_res, v_res, format, orientation, reversed);
+    glyph_cache_create(&clock_glyphs, pax_font_sky_mono, CLOCK_SIZE, "0123456789:");
+    glyph_cache_create(&text_glyphs_18, pax_font_sky_mono, 18, GLYPH_CACHE_ASCII_PRINTABLE);
+    glyph_cache_create(&text_glyphs_16, pax_font_sky_mono, 16, GLYPH_CACHE_ASCII_PRINTABLE);
+
+    // Damage is tracked in oriented coordinates
+    if (orientation == PAX_O_ROT_CCW || orientation == PAX_O_ROT_CW) {
+        damage_init(v_res, h_res);
+    } else {
+        damage_init(h_res, v_res);
+    }
+    damage_add_all();
+}
+
+// Without a wallpaper the background layer is left plain
+void ui_set_wallpaper(uint8_t const* png, size_t size) {
+    wallpaper      = png;
+    wallpaper_size = size;
+}
+
+void ui_set_connection_status(char const* status) {
+    char text[APP_STATE_STATUS_LENGTH];
+    snprintf(text, sizeof(text), "Wi-Fi: %s", status);
+
+    app_state_t* state = app_state_begin_update();
+    memcpy(state->connection_status, text, sizeof(text));
+    app_state_end_update();
+    damage_region(header_region());
+    render_scheduler_post();
+}
+
+// Status has to be a string literal, it is drawn from where it is
+void ui_set_publish_status(char const* status) {
+    app_state_begin_update()->publish_status = status;
+    app_state_end_update();
+    damage_region(header_region());
+    render_scheduler_post();
+}
+
+// Takes a new copy of the application state only when it changed. Called after taking the damage:
+// a change made after that is drawn by the next frame, with the damage it adds.
+static void refresh_frame_state(void) {
+    if (app_state_version() != frame_version) {
+        frame_version = app_state_read(&frame_state);
+    }
+}
+
+static uint32_t ring_history_count(void) {
+    uint32_t count = message_ring_count();
+    return count < MESSAGE_RING_CAPACITY ? count : MESSAGE_RING_CAPACITY;
+}
+
+// By default the history only reaches back as far as the RAM ring
+void ui_set_history_source(ui_history_count_t count, ui_history_get_t get) {
+    history_count = count;
+    history_get   = get;
+}
+
+void ui_set_animation_renderer(ui_animation_draw_t draw) {
+    animation_draw = draw;
+}
+
+// Only call from the MQTT task, the message ring has a single writer
+void ui_add_message(char const* topic, size_t topic_len, char const* text, size_t text_len) {
+    message_ring_push(topic, topic_len, text, text_len);
+    damage_region(history_region());
+    render_scheduler_post();
+}
+
+// Drawing functions
+static void draw_header(pax_buf_t* buf) {
+    pax_draw_line(buf, 0xFF2B2C3A, 10, HEADER_HEIGHT, display_v_res - 20, HEADER_HEIGHT);
+    glyph_cache_draw(buf, &text_glyphs_18, 0xFF2B2C3A, 5, 5, menu_title);
+    glyph_cache_draw(buf, &text_glyphs_18, 0xFF2B2C3A, 200, 5, frame_state.publish_status);
+    glyph_cache_draw(buf, &text_glyphs_18, 0xFF2B2C3A, display_h_res - 35, 5, frame_state.connection_status);
+}
+
+static void draw_footer(pax_buf_t* buf) {
+    pax_draw_line(buf, 0xFF2B2C3A, 10, display_h_res - FOOTER_HEIGHT, display_v_res - 20,
+                  display_h_res - FOOTER_HEIGHT);
+    glyph_cache_draw(buf, &text_glyphs_16, 0xFFFFFFFF, 5, display_v_res - FOOTER_HEIGHT, footer_text);
+}
+
+static void draw_buttons(pax_buf_t* buf) {
+    float start_x = (display_h_res - (button_count * BUTTON_WIDTH + (button_count - 1) * BUTTON_GAP)) / 2;
+    float y       = HEADER_HEIGHT + 40;
+
+    for (int i = 0; i < button_count; i++) {
+        pax_col_t color           = pax_col_rgb(100, 100, 100);
+        pax_col_t highlight_color = pax_col_rgb(150, 150, 150);
+        float     x               = start_x + i * (BUTTON_WIDTH + BUTTON_GAP);
+        pax_outline_rect(buf, color, x, y, BUTTON_WIDTH, BUTTON_HEIGHT);
+        if (i == frame_state.selected_button) {
+            pax_draw_rect(buf, highlight_color, x, y, BUTTON_WIDTH, BUTTON_HEIGHT);
+        }
+        glyph_cache_draw(buf, &text_glyphs_16, 0xFF000000, x + 10, y + 42, buttons[i]);
+    }
+}
+
+static void draw_history(pax_buf_t* buf) {
+    damage_rect_t region = history_region();
+    // Newest visible message on the bottom line
+    for (int line = 0; line < HISTORY_LINES; line++) {
+        message_t message;
+        if (!history_get(frame_state.history_offset + line, &message)) break;
+
+        struct tm received;
+        char      text[16 + MESSAGE_TEXT_LENGTH];
+        localtime_r(&message.received, &received);
+        size_t length = strftime(text, sizeof(text), "%H:%M:%S  ", &received);
+        snprintf(text + length, sizeof(text) - length, "%s", message.text);
+
+        int offset_y = region.y + region.h - (line + 1) * TEXT_FIELD_HEIGTH;
+        glyph_cache_draw(buf, &text_glyphs_18, 0xFF2B2C3A, 5, offset_y, text);
+    }
+}
+
+void ui_scroll_history(bool older) {
+    uint32_t available  = history_count();
+    uint32_t max_offset = available > HISTORY_LINES ? available - HISTORY_LINES : 0;
+
+    app_state_t* state  = app_state_begin_update();
+    uint32_t     offset = state->history_offset;
+    if (older && offset < max_offset) offset++;
+    else if (!older && offset > 0) offset--;
+    bool changed          = offset != state->history_offset;
+    state->history_offset = offset;
+    app_state_end_update();
+
+    if (changed) {
+        damage_region(history_region());
+        render_scheduler_post();
+    }
+}
+
+void ui_select_next_button(bool right) {
+    app_state_t* state    = app_state_begin_update();
+    int          previous = state->selected_button;
+    int          next     = previous + (right ? 1 : -1);
+    if (next >= button_count) next = 0;
+    else if (next < 0) next = button_count - 1;
+    state->selected_button = next;
+    app_state_end_update();
+
+    damage_region(button_region(previous));
+    damage_region(button_region(next));
+    render_scheduler_post();
+}
+
+int ui_selected_button(void) {
+    app_state_t state;
+    app_state_read(&state);
+    return state.selected_button;
+}
+
+// The labels have to stay valid, they are drawn from where they are
+void ui_set_buttons(char const* const* labels, size_t count) {
+    if (count == 0 || count > UI_MAX_BUTTONS) return;
+    damage_region(buttons_region());
+    buttons      = labels;
+    button_count = count;
+
+    app_state_begin_update()->selected_button = 0;
+    app_state_end_update();
+    damage_region(buttons_region());
+    render_scheduler_post();
+}
+
+static void show_screen(ui_screen_t next) {
+    damage_add_all();
+    render_scheduler_set_clock(next == UI_SCREEN_CLOCK);
+}
+
+void ui_set_screen(ui_screen_t next) {
+    app_state_begin_update()->screen = next;
+    app_state_end_update();
+    show_screen(next);
+}
+
+// Shows the screen, or the main screen when it is already shown
+void ui_toggle_screen(ui_screen_t toggled) {
+    app_state_t* state = app_state_begin_update();
+    state->screen      = state->screen == toggled ? UI_SCREEN_MAIN : toggled;
+    ui_screen_t next   = state->screen;
+    app_state_end_update();
+    show_screen(next);
+}
+
+// Switches to the next screen only if the current one is still the expected one. Returns false
+// when another task changed the screen in the meantime.
+bool ui_replace_screen(ui_screen_t expected, ui_screen_t next) {
+    app_state_t* state    = app_state_begin_update();
+    bool         replaced = state->screen == expected;
+    if (replaced) state->screen = next;
+    app_state_end_update();
+    if (replaced) show_screen(next);
+    return replaced;
+}
+
+ui_screen_t ui_get_screen(void) {
+    app_state_t state;
+    app_state_read(&state);
+    return state.screen;
+}
+
+// Forces the clock to be redrawn on the next clock frame, even if the second did not change
+void ui_invalidate_clock(void) {
+    clock_drawn_time = 0;
+}
+
+// Seconds are left out while the clock only updates once a minute
+void ui_set_clock_seconds(bool seconds) {
+    if (seconds != clock_seconds) {
+        clock_seconds = seconds;
+        damage_region(clock_region());
+    }
+}
+
+// Redraws only the damaged regions and pushes only those regions to the panel
+static void render_gui(damage_rect_t const* rects, size_t count) {
+    if (count == 0) return;
+
+    int64_t start = perf_now();
+    fb            = panel_begin_frame();
+
+    damage_rect_t header  = header_region();
+    damage_rect_t buttons = buttons_region();
+    damage_rect_t footer  = footer_region();
+    damage_rect_t history = history_region();
+
+    for (size_t i = 0; i < count; i++) {
+        damage_rect_t const* rect = &rects[i];
+        pax_set_clip(fb, (pax_recti){rect->x, rect->y, rect->w, rect->h});
+        pax_draw_rect(fb, pax_col_rgb(220, 220, 220), rect->x, rect->y, rect->w, rect->h);
+        if (damage_intersects(rect, &header)) draw_header(fb);
+        if (damage_intersects(rect, &buttons)) draw_buttons(fb);
+        if (damage_intersects(rect, &footer)) draw_footer(fb);
+        if (damage_intersects(rect, &history)) draw_history(fb);
+        pax_noclip(fb);
+        panel_flush(rect->x, rect->y, rect->w, rect->h);
+    }
+    perf_record(PERF_HIST_RENDER, perf_now() - start);
+    panel_end_frame();
+}
+
+static void draw_background(pax_buf_t* buf) {
+    if (wallpaper != NULL) {
+        pax_insert_png_buf(buf, wallpaper, wallpaper_size, 0, 0, 0);
+    } else {
+        pax_background(buf, 0xFF202020);
+    }
+    pax_draw_text(buf, 0xFFFFFFFF, pax_font_sky_mono, 40, 180, 380, menu_title);
+}
+
+static void render_wallpaper_clock(damage_rect_t const* rects, size_t count) {
+    if (count == 0) return;
+
+    char      strftime_buf[64];
+    struct tm timeinfo;
+    localtime_r(&now_time, &timeinfo);
+    strftime(strftime_buf, sizeof(strftime_buf), clock_seconds ? "%H:%M:%S" : "%H:%M", &timeinfo);
+
+    int64_t start = esp_timer_get_time();
+    fb            = panel_begin_frame();
+
+    // The wallpaper and title are decoded once into a background layer and copied from there
+    if (background_prepare(display_h_res, display_v_res, display_buf_format, display_orientation,
+                           display_reversed)) {
+        draw_background(background_get_buffer());
+    }
+
+    if (background_get_buffer() != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            background_restore(fb, rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+        }
+    } else {
+        draw_background(fb);
+    }
+
+    glyph_cache_draw(fb, &clock_glyphs, 0xFFFFFFFF, CLOCK_X, CLOCK_Y, strftime_buf);
+    clock_drawn_time = now_time;
+    int64_t drawn = esp_timer_get_time();
+    perf_record(PERF_HIST_RENDER, drawn - start);
+
+    for (size_t i = 0; i < count; i++) {
+        panel_flush(rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+    }
+    panel_end_frame();
+
+    ESP_LOGD(TAG, "Clock frame: draw %" PRId64 " us, submit %" PRId64 " us", drawn - start,
+             esp_timer_get_time() - drawn);
+}
+
+// Latency and receive filter statistics, redrawn as a whole whenever any damage is pending
+static void render_diagnostics(bool damaged) {
+    if (!damaged) return;
+
+    latency_stats_t total;
+    latency_stats_t senders[LATENCY_MAX_SENDERS];
+    size_t          count = latency_get_stats(&total, senders, LATENCY_MAX_SENDERS);
+
+    fb = panel_begin_frame();
+    pax_background(fb, pax_col_rgb(220, 220, 220));
+    draw_header(fb);
+
+    char line[96];
+    int  y = HEADER_HEIGHT + 20;
+    glyph_cache_draw(fb, &text_glyphs_18, 0xFF2B2C3A, 5, y, "Notification latency (send to display)");
+    y += 2 * TEXT_FIELD_HEIGTH;
+
+    snprintf(line, sizeof(line), "%-20s %8s %6s %8s %8s %8s", "Sender", "Received", "Lost", "p50 ms", "p95 ms",
+             "p99 ms");
+    glyph_cache_draw(fb, &text_glyphs_16, 0xFF2B2C3A, 5, y, line);
+    y += TEXT_FIELD_HEIGTH;
+
+    for (size_t i = 0; i <= count; i++) {
+        latency_stats_t const* stats = i < count ? &senders[i] : &total;
+        snprintf(line, sizeof(line), "%-20.20s %8lu %6lu %8lu %8lu %8lu", i < count ? stats->sender : "All senders",
+                 (unsigned long)stats->received, (unsigned long)stats->lost, (unsigned long)stats->p50_ms,
+                 (unsigned long)stats->p95_ms, (unsigned long)stats->p99_ms);
+        if (i == count) y += TEXT_FIELD_HEIGTH / 2;
+        glyph_cache_draw(fb, &text_glyphs_16, 0xFF2B2C3A, 5, y, line);
+        y += TEXT_FIELD_HEIGTH;
+    }
+
+    rx_filter_stats_t dropped;
+    rx_filter_get_stats(&dropped);
+    snprintf(line, sizeof(line), "Dropped: %lu duplicates, %lu own events, %lu over the rate limit",
+             (unsigned long)dropped.duplicates, (unsigned long)dropped.echoes, (unsigned long)dropped.flooded);
+    y += TEXT_FIELD_HEIGTH;
+    glyph_cache_draw(fb, &text_glyphs_16, 0xFF2B2C3A, 5, y, line);
+
+    panel_flush_all();
+    panel_end_frame();
+}
+
+// The animation owns the whole screen: it is cleared once when the screen is entered, after that only
+// the animation frames are drawn and damage from the other screens is dropped
+static void render_animation(void) {
+    fb = panel_begin_frame();
+    if (animation_clear) {
+        animation_clear = false;
+        pax_background(fb, 0xFF000000);
+        panel_flush_all();
+    }
+    if (animation_draw != NULL) {
+        animation_draw(fb);
+    }
+    panel_end_frame();
+}
+
+// Damage that comes from time passing or from counters, rather than from a change made through the UI.
+// The screen is the one drawn last: switching to another screen damages all of it anyway.
+static void damage_screen_content(ui_screen_t screen) {
+    time(&now_time);
+    if (screen == UI_SCREEN_CLOCK && now_time != clock_drawn_time) {
+        damage_region(clock_region());
+    }
+
+    // Both statistics only count up, so their sum changes with either
+    uint32_t version = latency_version() + rx_filter_version();
+    if (version != diagnostics_version) {
+        diagnostics_version = version;
+        if (screen == UI_SCREEN_DIAGNOSTICS) damage_add_all();
+    }
+}
+
+void ui_render(void) {
+    latency_frame_begin();
+    damage_screen_content(rendered_screen);
+
+    damage_rect_t rects[DAMAGE_MAX_RECTS];
+    size_t        count = damage_take(rects, DAMAGE_MAX_RECTS);
+    refresh_frame_state();
+    if (frame_state.screen != rendered_screen) {
+        rendered_screen = frame_state.screen;
+        animation_clear = rendered_screen == UI_SCREEN_ANIMATION;
+    }
+    switch (rendered_screen) {
+        case UI_SCREEN_CLOCK:
+            render_wallpaper_clock(rects, count);
+            break;
+        case UI_SCREEN_DIAGNOSTICS:
+            render_diagnostics(count > 0);
+            break;
+        case UI_SCREEN_ANIMATION:
+            render_animation();
+            break;
+        case UI_SCREEN_MAIN:
+        default:
+            render_gui(rects, count);
+            break;
+    }
+    latency_frame_presented();
+}
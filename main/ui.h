@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "message_ring.h"
+#include "pax_types.h"
+
+#define UI_MAX_BUTTONS 4
+
+typedef enum {
+    UI_SCREEN_MAIN,
+    UI_SCREEN_CLOCK,
+    UI_SCREEN_DIAGNOSTICS,
+    UI_SCREEN_ANIMATION,
+} ui_screen_t;
+
+// Messages shown in the history, by age (0 is the newest)
+typedef uint32_t (*ui_history_count_t)(void);
+typedef bool (*ui_history_get_t)(uint32_t age, message_t* out);
+
+// Draws the current animation frame, if there is a new one, and flushes what it drew
+typedef void (*ui_animation_draw_t)(pax_buf_t* fb);
+
+void        ui_init(size_t h_res, size_t v_res, pax_buf_type_t format, pax_orientation_t orientation, bool reversed);
+void        ui_set_wallpaper(uint8_t const* png, size_t size);
+void        ui_set_connection_status(char const* status);
+void        ui_set_publish_status(char const* status);
+void        ui_set_history_source(ui_history_count_t count, ui_history_get_t get);
+void        ui_set_animation_renderer(ui_animation_draw_t draw);
+void        ui_add_message(char const* topic, size_t topic_len, char const* text, size_t text_len);
+void        ui_set_buttons(char const* const* labels, size_t count);
+void        ui_select_next_button(bool right);
+int         ui_selected_button(void);
+void        ui_scroll_history(bool older);
+void        ui_set_screen(ui_screen_t screen);
+void        ui_toggle_screen(ui_screen_t screen);
+bool        ui_replace_screen(ui_screen_t expected, ui_screen_t next);
+ui_screen_t ui_get_screen(void);
+void        ui_invalidate_clock(void);
+void        ui_set_clock_seconds(bool seconds);
+void        ui_render(void);